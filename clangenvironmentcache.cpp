@@ -0,0 +1,371 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "clangenvironmentcache.h"
+
+#include <interfaces/icore.h>
+#include <interfaces/iproject.h>
+#include <interfaces/iprojectcontroller.h>
+
+#include <custom-definesandincludes/idefinesandincludesmanager.h>
+
+#include <project/projectmodel.h>
+#include <project/interfaces/ibuildsystemmanager.h>
+
+#include <serialization/indexedstring.h>
+
+#include "duchain/clanghelpers.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QVariant>
+
+#include <algorithm>
+
+using namespace KDevelop;
+
+namespace {
+
+const QString pchIncludeFilename = QStringLiteral(".kdev_pch_include");
+/// read by the include path manager of files outside of projects, written by its include path setup dialog
+const QString includePathsFilename = QStringLiteral(".kdev_include_paths");
+
+/// @return the path of @p configFileName in the directory of @p forFile or the closest parent directory containing it
+QString findConfigFile(const QString& forFile, const QString& configFileName)
+{
+    QDir dir = QFileInfo(forFile).dir();
+    while (dir.exists()) {
+        const QFileInfo customIncludePaths(dir, configFileName);
+        if (customIncludePaths.exists()) {
+            return customIncludePaths.absoluteFilePath();
+        }
+
+        if (!dir.cdUp()) {
+            break;
+        }
+    }
+
+    return {};
+}
+
+/**
+ * @return the modification times of the config files which may apply to @p forFile, by their path,
+ *         i.e. of the ones in its directory and all parent directories, invalid for missing files
+ */
+QVariantHash configFileTimes(const QString& forFile)
+{
+    QVariantHash times;
+    QDir dir = QFileInfo(forFile).dir();
+    do {
+        for (const auto& name : {pchIncludeFilename, includePathsFilename}) {
+            const QFileInfo file(dir, name);
+            times.insert(file.absoluteFilePath(), file.exists() ? file.lastModified() : QDateTime());
+        }
+    } while (dir.cdUp());
+    return times;
+}
+
+Path::List readPathListFile(const QString& filepath)
+{
+    if (filepath.isEmpty()) {
+        return {};
+    }
+
+    QFile f(filepath);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return {};
+    }
+
+    const QString text = QString::fromLocal8Bit(f.readAll());
+    const QStringList lines = text.split(QLatin1Char('\n'), QString::SkipEmptyParts);
+    Path::List paths(lines.length());
+    std::transform(lines.begin(), lines.end(), paths.begin(), [] (const QString& line) { return Path(line); });
+    return paths;
+}
+
+/**
+ * File should contain the header to precompile and use while parsing
+ * @returns the first path in the file
+ */
+Path userDefinedPchIncludeForFile(const QString& sourcefile)
+{
+    const auto paths = readPathListFile(findConfigFile(sourcefile, pchIncludeFilename));
+    return paths.isEmpty() ? Path() : paths.first();
+}
+
+}
+
+ClangEnvironmentCache::ClangEnvironmentCache(QObject* parent)
+    : QObject(parent)
+{
+    auto projectController = ICore::self()->projectController();
+    connect(projectController, &IProjectController::projectOpened, this, &ClangEnvironmentCache::clear);
+    connect(projectController, &IProjectController::projectClosed, this, &ClangEnvironmentCache::clear);
+    connect(projectController, &IProjectController::projectConfigurationChanged, this, &ClangEnvironmentCache::clear);
+
+    // the items are used as keys, drop the entries of a project when some of its items go away
+    auto projectModel = projectController->projectModel();
+    connect(projectModel, &QAbstractItemModel::rowsAboutToBeRemoved, this,
+            [this, projectModel] (const QModelIndex& parent, int first, int last) {
+        for (int row = first; row <= last; ++row) {
+            if (auto item = projectModel->itemFromIndex(projectModel->index(row, 0, parent))) {
+                clearProject(item->project());
+            }
+        }
+    });
+    connect(projectModel, &QAbstractItemModel::modelReset, this, &ClangEnvironmentCache::clear);
+
+    connect(&m_configFileWatcher, &QFileSystemWatcher::directoryChanged, this, [this] (const QString& directory) {
+        bool changed = false;
+        for (const auto& name : {pchIncludeFilename, includePathsFilename}) {
+            changed = configFileChanged(QFileInfo(directory, name).absoluteFilePath(), false) || changed;
+        }
+        if (changed) {
+            clear();
+        }
+    });
+    connect(&m_configFileWatcher, &QFileSystemWatcher::fileChanged, this, [this] (const QString& path) {
+        if (configFileChanged(path, true)) {
+            clear();
+        }
+    });
+}
+
+ClangEnvironmentCache::~ClangEnvironmentCache() = default;
+
+void ClangEnvironmentCache::clear()
+{
+    m_entries.clear();
+    m_projectPathsValid = false;
+
+    QMutexLocker lock(&m_backgroundMutex);
+    m_backgroundEntries.clear();
+    ++m_generation;
+}
+
+void ClangEnvironmentCache::clearProject(IProject* project)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it->project == project) {
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ClangEnvironmentCache::watchConfigFiles(const QVariantHash& times)
+{
+    bool changed = false;
+    for (auto it = times.constBegin(); it != times.constEnd(); ++it) {
+        if (m_configFiles.contains(it.key())) {
+            continue;
+        }
+
+        const QFileInfo file(it.key());
+        const auto current = file.exists() ? file.lastModified() : QDateTime();
+        m_configFiles.insert(it.key(), current);
+        if (!m_configFileWatcher.directories().contains(file.path())) {
+            m_configFileWatcher.addPath(file.path());
+        }
+        if (file.exists()) {
+            m_configFileWatcher.addPath(file.filePath());
+        }
+
+        changed = changed || current != it.value().toDateTime();
+    }
+
+    if (changed) {
+        // it changed before the watch got added
+        clear();
+    }
+}
+
+bool ClangEnvironmentCache::configFileChanged(const QString& path, bool modified)
+{
+    auto it = m_configFiles.find(path);
+    if (it == m_configFiles.end()) {
+        return false;
+    }
+
+    const QFileInfo file(path);
+    const auto current = file.exists() ? file.lastModified() : QDateTime();
+    // other files of the directory changed
+    if (!modified && current == *it) {
+        return false;
+    }
+
+    *it = current;
+    if (file.exists() && !m_configFileWatcher.files().contains(path)) {
+        // saving may replace the file, which ends the watch of the previous one
+        m_configFileWatcher.addPath(path);
+    }
+    return true;
+}
+
+ClangEnvironmentCache::Entry ClangEnvironmentCache::entry(ProjectFileItem* file, const IndexedString& url)
+{
+    auto project = file ? file->project() : nullptr;
+    auto bsm = project ? project->buildSystemManager() : nullptr;
+    const bool hasBuildSystemInfo = bsm && bsm->hasIncludesOrDefines(file);
+
+    ProjectBaseItem* keyItem = file;
+    Path keyPath;
+    if (!file) {
+        keyPath = Path(url.str());
+    } else if (!hasBuildSystemInfo && file->parent()) {
+        // the custom settings apply per directory, share them with the other files of the target or folder
+        // otherwise the build system may pass different flags for each file
+        keyItem = file->parent();
+        keyPath = file->path().parent();
+    }
+    const auto key = qMakePair(keyItem, keyPath);
+
+    auto it = m_entries.constFind(key);
+    if (it != m_entries.constEnd()) {
+        return *it;
+    }
+
+    Entry entry;
+    auto manager = IDefinesAndIncludesManager::manager();
+    if (file) {
+        entry.includes = manager->includes(file);
+        entry.defines = manager->defines(file);
+        entry.parserSettings = ClangSettingsManager::self()->parserSettings(file);
+        entry.hasProjectIncludes = !manager->includes(file, IDefinesAndIncludesManager::ProjectSpecific).isEmpty();
+        entry.hasBuildSystemInfo = hasBuildSystemInfo;
+        entry.project = project;
+        if (project) {
+            entry.projectName = project->name();
+        }
+    } else {
+        entry.includes = manager->includes(url.str());
+        entry.defines = manager->defines(url.str());
+        entry.parserSettings = ClangSettingsManager::self()->parserSettings(nullptr);
+    }
+    m_entries.insert(key, entry);
+    return entry;
+}
+
+ClangEnvironmentCache::Entry ClangEnvironmentCache::findEntry(const IndexedString& url)
+{
+    ProjectFileItem* file = nullptr;
+    Entry found;
+
+    foreach (auto project, ICore::self()->projectController()->projects()) {
+        const auto files = project->filesForPath(url);
+        if (files.isEmpty()) {
+            continue;
+        }
+
+        file = files.last();
+        found = entry(file, url);
+
+        // A file might be defined in different targets.
+        // Prefer file items defined inside a target with non-empty includes.
+        foreach (auto f, files) {
+            if (!dynamic_cast<ProjectTargetItem*>(f->parent())) {
+                continue;
+            }
+            file = f;
+            found = entry(f, url);
+            if (found.hasProjectIncludes) {
+                break;
+            }
+        }
+    }
+
+    return file ? found : entry(nullptr, url);
+}
+
+ClangParsingEnvironment ClangEnvironmentCache::environment(const IndexedString& tuUrl, QString* projectName)
+{
+    const auto found = findEntry(tuUrl);
+
+    ClangParsingEnvironment environment;
+    environment.addIncludes(found.includes);
+    environment.addDefines(found.defines);
+    environment.setParserSettings(found.parserSettings);
+    const bool isSource = ClangHelpers::isSource(tuUrl.str());
+    environment.setQuality(
+        isSource ? (found.hasBuildSystemInfo ? ClangParsingEnvironment::BuildSystem : ClangParsingEnvironment::Source)
+        : ClangParsingEnvironment::Unknown
+    );
+    environment.setTranslationUnitUrl(tuUrl);
+
+    if (!m_projectPathsValid) {
+        const auto& projects = ICore::self()->projectController()->projects();
+        m_projectPaths.clear();
+        m_projectPaths.reserve(projects.size());
+        foreach (auto project, projects) {
+            m_projectPaths.append(project->path());
+        }
+        m_projectPathsValid = true;
+    }
+    environment.setProjectPaths(m_projectPaths);
+
+    *projectName = found.projectName;
+    return environment;
+}
+
+void ClangEnvironmentCache::addBackgroundEnvironment(ClangParsingEnvironment* environment)
+{
+    const auto tuUrl = environment->translationUnitUrl();
+
+    BackgroundEntry entry;
+    bool found = false;
+    int generation = 0;
+    {
+        QMutexLocker lock(&m_backgroundMutex);
+        auto it = m_backgroundEntries.constFind(tuUrl);
+        found = (it != m_backgroundEntries.constEnd());
+        if (found) {
+            entry = *it;
+        }
+        generation = m_generation;
+    }
+
+    if (!found) {
+        // before reading them, a later change is noticed then
+        const auto times = configFileTimes(tuUrl.str());
+
+        // the background queries may take a while, don't block other parse jobs meanwhile
+        auto manager = IDefinesAndIncludesManager::manager();
+        entry.includes = manager->includesInBackground(tuUrl.str());
+        entry.defines = manager->definesInBackground(tuUrl.str());
+        entry.pchInclude = userDefinedPchIncludeForFile(tuUrl.str());
+
+        {
+            QMutexLocker lock(&m_backgroundMutex);
+            // don't store outdated results when the cache got cleared in between
+            if (generation == m_generation) {
+                m_backgroundEntries.insert(tuUrl, entry);
+            }
+        }
+        // the watcher lives in the main thread
+        QMetaObject::invokeMethod(this, "watchConfigFiles", Q_ARG(QVariantHash, times));
+    }
+
+    environment->addIncludes(entry.includes);
+    environment->addDefines(entry.defines);
+    environment->setPchInclude(entry.pchInclude);
+}
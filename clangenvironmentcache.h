@@ -0,0 +1,141 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef CLANG_CLANGENVIRONMENTCACHE_H
+#define CLANG_CLANGENVIRONMENTCACHE_H
+
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QVariant>
+
+#include <serialization/indexedstring.h>
+#include <util/path.h>
+
+#include "clangsettings/clangsettingsmanager.h"
+#include "duchain/clangparsingenvironment.h"
+
+namespace KDevelop {
+class IProject;
+class ProjectBaseItem;
+class ProjectFileItem;
+}
+
+/**
+ * Caches the parsing environments of translation units.
+ *
+ * Reparsing a file thus does not query its include paths, defines and parser settings again.
+ * Files of the same target or folder in the same directory share their entry, unless the build
+ * system provides the flags, which may differ for each file. The entries of a project are dropped
+ * when some of its items are removed, everything is dropped when a project is opened, closed or
+ * reconfigured.
+ *
+ * The parts which may only be queried in the background are cached per translation unit.
+ * As the include path providers may read .kdev_include_paths files, everything is dropped
+ * when such a file or a .kdev_pch_include file that may apply to a cached file changes.
+ */
+class ClangEnvironmentCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ClangEnvironmentCache(QObject* parent = nullptr);
+    ~ClangEnvironmentCache() override;
+
+    /**
+     * @return the environment to parse @p tuUrl in, including the project paths and the quality
+     *
+     * @p projectName is set to the name of the project containing @p tuUrl, if any.
+     * This function must be called from the main thread.
+     */
+    ClangParsingEnvironment environment(const KDevelop::IndexedString& tuUrl, QString* projectName);
+
+    /**
+     * Add the include paths and defines which may only be queried in the background,
+     * as well as the user defined PCH include, to @p environment.
+     *
+     * This function is thread safe.
+     */
+    void addBackgroundEnvironment(ClangParsingEnvironment* environment);
+
+public slots:
+    void clear();
+
+private:
+    /// drop the entries of the files of @p project
+    void clearProject(KDevelop::IProject* project);
+    /**
+     * Watch the config files in @p times, which maps their paths to the modification time
+     * they had before they were read, invalid for missing files.
+     */
+    Q_INVOKABLE void watchConfigFiles(const QVariantHash& times);
+    /**
+     * Update the modification time of the watched config file at @p path.
+     * @p modified is true when the file itself was reported as modified, not only its directory.
+     * @return true when the file was created, changed or removed
+     */
+    bool configFileChanged(const QString& path, bool modified);
+
+    struct Entry
+    {
+        KDevelop::Path::List includes;
+        QHash<QString, QString> defines;
+        ParserSettings parserSettings;
+        /// the project of the file, only used to drop the entry
+        KDevelop::IProject* project = nullptr;
+        QString projectName;
+        /// true when the project specific includes are not empty
+        bool hasProjectIncludes = false;
+        bool hasBuildSystemInfo = false;
+    };
+
+    struct BackgroundEntry
+    {
+        KDevelop::Path::List includes;
+        QHash<QString, QString> defines;
+        KDevelop::Path pchInclude;
+    };
+
+    Entry entry(KDevelop::ProjectFileItem* file, const KDevelop::IndexedString& url);
+    /// @return the entry for the file item of @p url which provides the most information
+    Entry findEntry(const KDevelop::IndexedString& url);
+
+    /**
+     * keyed by the parent item and directory of shared entries, by the file item with an empty path
+     * otherwise, or by the path alone for files which are not part of a project
+     */
+    QHash<QPair<KDevelop::ProjectBaseItem*, KDevelop::Path>, Entry> m_entries;
+    KDevelop::Path::List m_projectPaths;
+    bool m_projectPathsValid = false;
+
+    QMutex m_backgroundMutex;
+    /// keyed by the translation unit, as the include path providers answer per file
+    QHash<KDevelop::IndexedString, BackgroundEntry> m_backgroundEntries;
+    /// incremented by clear(), to drop background entries computed before
+    int m_generation = 0;
+
+    QFileSystemWatcher m_configFileWatcher;
+    /// the modification time of each watched config file by its path, invalid for missing files
+    QHash<QString, QDateTime> m_configFiles;
+};
+
+#endif // CLANG_CLANGENVIRONMENTCACHE_H
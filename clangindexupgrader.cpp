@@ -0,0 +1,200 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "clangindexupgrader.h"
+
+#include <interfaces/icore.h>
+#include <interfaces/idocumentcontroller.h>
+#include <interfaces/ilanguagecontroller.h>
+#include <interfaces/iprojectcontroller.h>
+#include <interfaces/iuicontroller.h>
+
+#include <language/backgroundparser/backgroundparser.h>
+#include <language/backgroundparser/parsejob.h>
+#include <language/duchain/duchainlock.h>
+#include <language/duchain/topducontext.h>
+
+#include <KLocalizedString>
+
+#include "clangsettings/clangsettingsmanager.h"
+#include "clangsupport.h"
+
+using namespace KDevelop;
+
+namespace {
+
+/// Minimum time in milliseconds between two upgrades, and the time to wait when the background parser is busy
+const int UpgradeInterval = 1000;
+
+BackgroundParser* backgroundParser()
+{
+    return ICore::self()->languageController()->backgroundParser();
+}
+
+}
+
+ClangIndexUpgrader::ClangIndexUpgrader(ClangSupport* support)
+    : QObject(support)
+    , m_support(support)
+{
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(UpgradeInterval);
+    connect(&m_idleTimer, &QTimer::timeout, this, &ClangIndexUpgrader::upgradeNext);
+
+    connect(backgroundParser(), &BackgroundParser::parseJobFinished,
+            this, &ClangIndexUpgrader::parseJobFinished);
+    ICore::self()->uiController()->registerStatus(this);
+}
+
+ClangIndexUpgrader::~ClangIndexUpgrader() = default;
+
+QString ClangIndexUpgrader::statusName() const
+{
+    return i18n("Project Indexing");
+}
+
+bool ClangIndexUpgrader::isProjectImport(const ParseJob* job)
+{
+    return job->parsePriority() == BackgroundParser::InitialParsePriority
+        && !(job->minimumFeatures() & TopDUContext::ForceUpdate);
+}
+
+void ClangIndexUpgrader::parseJobFinished(ParseJob* job)
+{
+    if (job->languageSupport() != m_support) {
+        return;
+    }
+
+    const auto url = job->document();
+    if (url == m_current) {
+        currentFinished(job);
+        return;
+    }
+
+    // only the project files parsed initially take part in the two-tier indexing, not the upgrades
+    if (!isProjectImport(job) || !ClangSettingsManager::self()->parsingSettings().twoTierIndexing
+        || m_pendingSet.contains(url))
+    {
+        return;
+    }
+    {
+        DUChainReadLocker lock;
+        const auto top = job->duChain();
+        if (!top || (top->features() & TopDUContext::AllDeclarationsContextsAndUses) == TopDUContext::AllDeclarationsContextsAndUses) {
+            return;
+        }
+    }
+
+    m_pending.append(url);
+    m_pendingSet.insert(url);
+    ++m_fastIndexed;
+
+    const int total = m_fastIndexed + backgroundParser()->queuedCount();
+    emit showMessage(this, i18np("Indexed declarations of %1 file", "Indexed declarations of %1 files", m_fastIndexed));
+    emit showProgress(this, 0, total, m_fastIndexed);
+
+    if (m_current.isEmpty()) {
+        m_idleTimer.start();
+    }
+}
+
+void ClangIndexUpgrader::upgradeNext()
+{
+    auto parser = backgroundParser();
+    if (!m_current.isEmpty()) {
+        if (parser->isQueued(m_current) || parser->parseJobForDocument(m_current)) {
+            m_idleTimer.start();
+            return;
+        }
+        // the upgrade got removed from the background parser before it ran, so it never finishes
+        retryCurrent();
+        return;
+    }
+
+    if (parser->queuedCount()) {
+        // the first tier or the user's edits keep the background parser busy, retry later
+        m_idleTimer.start();
+        return;
+    }
+    m_fastIndexed = 0;
+
+    while (!m_pending.isEmpty()) {
+        const auto url = m_pending.takeFirst();
+        m_pendingSet.remove(url);
+        // open documents get parsed with all uses anyways, and files of closed projects are not indexed
+        if (ICore::self()->documentController()->documentForUrl(url.toUrl())
+            || !ICore::self()->projectController()->findProjectForUrl(url.toUrl()))
+        {
+            continue;
+        }
+
+        m_current = url;
+        reportProgress();
+        parser->addDocument(url, TopDUContext::AllDeclarationsContextsAndUses, BackgroundParser::WorstPriority);
+        // check whether the upgrade is still queued until it finished
+        m_idleTimer.start();
+        return;
+    }
+
+    reportProgress();
+}
+
+void ClangIndexUpgrader::currentFinished(ParseJob* job)
+{
+    if (job->abortRequested()) {
+        retryCurrent();
+        return;
+    }
+    {
+        DUChainReadLocker lock;
+        const auto top = job->duChain();
+        if (top && (top->features() & TopDUContext::AllDeclarationsContextsAndUses) != TopDUContext::AllDeclarationsContextsAndUses) {
+            // another parse of the file finished first, the upgrade is still queued
+            return;
+        }
+    }
+
+    m_current = IndexedString();
+    ++m_upgraded;
+    reportProgress();
+    m_idleTimer.start();
+}
+
+void ClangIndexUpgrader::retryCurrent()
+{
+    m_pending.prepend(m_current);
+    m_pendingSet.insert(m_current);
+    m_current = IndexedString();
+    reportProgress();
+    m_idleTimer.start();
+}
+
+void ClangIndexUpgrader::reportProgress()
+{
+    const int total = m_upgraded + m_pending.size() + (m_current.isEmpty() ? 0 : 1);
+    if (m_upgraded == total) {
+        m_upgraded = 0;
+        emit clearMessage(this);
+        emit hideProgress(this);
+        return;
+    }
+
+    emit showMessage(this, i18n("Indexing uses of %1 of %2 files", m_upgraded + 1, total));
+    emit showProgress(this, 0, total, m_upgraded);
+}
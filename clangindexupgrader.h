@@ -0,0 +1,93 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef CLANG_CLANGINDEXUPGRADER_H
+#define CLANG_CLANGINDEXUPGRADER_H
+
+#include <interfaces/istatus.h>
+#include <serialization/indexedstring.h>
+
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+namespace KDevelop {
+class ParseJob;
+}
+
+class ClangSupport;
+
+/**
+ * Second tier of the two-tier project indexing, see ParsingSettings::twoTierIndexing.
+ *
+ * The first tier parses project files with skipped function bodies and without uses,
+ * to quickly populate the symbol table. Afterwards, the files indexed that way are
+ * reparsed with all uses, one at a time and only while the background parser is idle.
+ */
+class ClangIndexUpgrader : public QObject, public KDevelop::IStatus
+{
+    Q_OBJECT
+    Q_INTERFACES(KDevelop::IStatus)
+
+public:
+    explicit ClangIndexUpgrader(ClangSupport* support);
+    ~ClangIndexUpgrader() override;
+
+    QString statusName() const override;
+
+    /**
+     * @return true if @p job belongs to the initial parse of the project files, which the first tier indexes
+     * without uses. Reparsing the entire project on request does not, it forces the update of all files.
+     */
+    static bool isProjectImport(const KDevelop::ParseJob* job);
+
+signals:
+    void clearMessage(KDevelop::IStatus*) override;
+    void showMessage(KDevelop::IStatus*, const QString& message, int timeout = 0) override;
+    void showErrorMessage(const QString& message, int timeout = 0) override;
+    void hideProgress(KDevelop::IStatus*) override;
+    void showProgress(KDevelop::IStatus*, int minimum, int maximum, int value) override;
+
+private slots:
+    void parseJobFinished(KDevelop::ParseJob* job);
+    /// Upgrade the next file, if the background parser is idle, or retry the current one if it got dropped
+    void upgradeNext();
+
+private:
+    /// Called when a parse job for the file currently being upgraded finished
+    void currentFinished(KDevelop::ParseJob* job);
+    /// Upgrade the current file again later, when its upgrade got aborted or dropped
+    void retryCurrent();
+    void reportProgress();
+
+    ClangSupport* m_support;
+    QTimer m_idleTimer;
+    /// files indexed by the first tier, waiting for their uses
+    QVector<KDevelop::IndexedString> m_pending;
+    QSet<KDevelop::IndexedString> m_pendingSet;
+    /// the file currently being upgraded, if any
+    KDevelop::IndexedString m_current;
+    /// files indexed by the first tier since the last time it was idle
+    int m_fastIndexed = 0;
+    /// files upgraded by the second tier since it last ran out of files
+    int m_upgraded = 0;
+};
+
+#endif // CLANG_CLANGINDEXUPGRADER_H
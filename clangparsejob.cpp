@@ -23,10 +23,7 @@
 #include "clangparsejob.h"
 
 #include <interfaces/icore.h>
-#include <interfaces/iprojectcontroller.h>
-#include <interfaces/iproject.h>
 #include <interfaces/ilanguagecontroller.h>
-#include <interfaces/idocumentcontroller.h>
 
 #include <language/interfaces/icodehighlighting.h>
 
@@ -38,11 +35,6 @@
 #include <language/duchain/duchain.h>
 #include <language/duchain/parsingenvironment.h>
 
-#include <custom-definesandincludes/idefinesandincludesmanager.h>
-
-#include <project/projectmodel.h>
-#include <project/interfaces/ibuildsystemmanager.h>
-
 #include "clangsettings/clangsettingsmanager.h"
 #include "duchain/clanghelpers.h"
 #include "duchain/clangpch.h"
@@ -50,14 +42,14 @@
 #include "duchain/clangindex.h"
 #include "duchain/clangparsingenvironmentfile.h"
 #include "util/clangdebug.h"
+#include "util/clangprofiler.h"
 #include "util/clangtypes.h"
 
+#include "clangenvironmentcache.h"
+#include "clangindexupgrader.h"
 #include "clangsupport.h"
-#include "documentfinderhelpers.h"
 
-#include <QFile>
-#include <QStringList>
-#include <QFileInfo>
+#include <QMutex>
 #include <QReadLocker>
 #include <QProcess>
 #include <memory>
@@ -70,83 +62,35 @@ enum CustomFeatures {
     Rescheduled = (KDevelop::TopDUContext::LastFeature << 1)
 };
 
-QString findConfigFile(const QString& forFile, const QString& configFileName)
-{
-    QDir dir = QFileInfo(forFile).dir();
-    while (dir.exists()) {
-        const QFileInfo customIncludePaths(dir, configFileName);
-        if (customIncludePaths.exists()) {
-            return customIncludePaths.absoluteFilePath();
-        }
-
-        if (!dir.cdUp()) {
-            break;
-        }
-    }
-
-    return {};
-}
-
-Path::List readPathListFile(const QString& filepath)
-{
-    if (filepath.isEmpty()) {
-        return {};
-    }
-
-    QFile f(filepath);
-    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        return {};
-    }
-
-    const QString text = QString::fromLocal8Bit(f.readAll());
-    const QStringList lines = text.split(QLatin1Char('\n'), QString::SkipEmptyParts);
-    Path::List paths(lines.length());
-    std::transform(lines.begin(), lines.end(), paths.begin(), [] (const QString& line) { return Path(line); });
-    return paths;
-}
-
 /**
- * File should contain the header to precompile and use while parsing
- * @returns the first path in the file
+ * @returns the includes at the top of @p file, up to the first other construct or
+ * include of a header that is not guarded against multiple inclusion
  */
-Path userDefinedPchIncludeForFile(const QString& sourcefile)
+Path::List leadingIncludes(CXTranslationUnit unit, CXFile file)
 {
-    static const QString pchIncludeFilename = QStringLiteral(".kdev_pch_include");
-    const auto paths = readPathListFile(findConfigFile(sourcefile, pchIncludeFilename));
-    return paths.isEmpty() ? Path() : paths.first();
-}
-
-ProjectFileItem* findProjectFileItem(const IndexedString& url, bool* hasBuildSystemInfo)
-{
-    ProjectFileItem* file = nullptr;
-
-    *hasBuildSystemInfo = false;
-    for (auto project: ICore::self()->projectController()->projects()) {
-        auto files = project->filesForPath(url);
-        if (files.isEmpty()) {
-            continue;
-        }
-
-        file = files.last();
-
-        // A file might be defined in different targets.
-        // Prefer file items defined inside a target with non-empty includes.
-        for (auto f: files) {
-            if (!dynamic_cast<ProjectTargetItem*>(f->parent())) {
-                continue;
-            }
-            file = f;
-            if (!IDefinesAndIncludesManager::manager()->includes(f, IDefinesAndIncludesManager::ProjectSpecific).isEmpty()) {
-                break;
-            }
+    struct Data
+    {
+        CXTranslationUnit unit;
+        CXFile file;
+        Path::List includes;
+    } data{unit, file, {}};
+
+    clang_visitChildren(clang_getTranslationUnitCursor(unit), [] (CXCursor cursor, CXCursor, CXClientData clientData) {
+        auto data = static_cast<Data*>(clientData);
+        CXFile cursorFile;
+        clang_getFileLocation(clang_getCursorLocation(cursor), &cursorFile, nullptr, nullptr, nullptr);
+        if (cursorFile != data->file) {
+            return CXChildVisit_Continue;
         }
-    }
-    if (file && file->project()) {
-        if (auto bsm = file->project()->buildSystemManager()) {
-            *hasBuildSystemInfo = bsm->hasIncludesOrDefines(file);
+        const CXFile included = (cursor.kind == CXCursor_InclusionDirective) ? clang_getIncludedFile(cursor) : nullptr;
+        if (!included || !clang_isFileMultipleIncludeGuarded(data->unit, included)) {
+            return CXChildVisit_Break;
         }
-    }
-    return file;
+        data->includes.append(Path(ClangString(clang_getFileName(included)).toString()));
+        return CXChildVisit_Continue;
+    }, &data);
+
+    return data.includes;
 }
 
 ClangParsingEnvironmentFile* parsingEnvironmentFile(const TopDUContext* context)
@@ -159,6 +103,14 @@ bool hasTracker(const IndexedString& url)
     return ICore::self()->languageController()->backgroundParser()->trackerForUrl(url);
 }
 
+/// The most recently created parse job per translation unit, see ClangParseJob::isSuperseded()
+struct NewestParseJobs
+{
+    QMutex mutex;
+    QHash<IndexedString, ClangParseJob*> jobs;
+};
+Q_GLOBAL_STATIC(NewestParseJobs, s_newestParseJobs)
+
 ParseSessionData::Ptr findParseSession(const IndexedString &file)
 {
     DUChainReadLocker lock;
@@ -174,43 +126,45 @@ ParseSessionData::Ptr findParseSession(const IndexedString &file)
 ClangParseJob::ClangParseJob(const IndexedString& url, ILanguageSupport* languageSupport)
     : ParseJob(url, languageSupport)
 {
+    ClangProfiler::Scope profile("environment", url.str());
     const auto tuUrl = clang()->index()->translationUnitForUrl(url);
-    bool hasBuildSystemInfo;
-    if (auto file = findProjectFileItem(tuUrl, &hasBuildSystemInfo)) {
-        m_environment.addIncludes(IDefinesAndIncludesManager::manager()->includes(file));
-        m_environment.addDefines(IDefinesAndIncludesManager::manager()->defines(file));
-        m_environment.setParserSettings(ClangSettingsManager::self()->parserSettings(file));
-    } else {
-        m_environment.addIncludes(IDefinesAndIncludesManager::manager()->includes(tuUrl.str()));
-        m_environment.addDefines(IDefinesAndIncludesManager::manager()->defines(tuUrl.str()));
-        m_environment.setParserSettings(ClangSettingsManager::self()->parserSettings(nullptr));
+    m_environment = clang()->environmentCache()->environment(tuUrl, &m_projectName);
+    profile.setProject(m_projectName);
+    {
+        QMutexLocker lock(&s_newestParseJobs->mutex);
+        s_newestParseJobs->jobs.insert(tuUrl, this);
     }
-    const bool isSource = ClangHelpers::isSource(tuUrl.str());
-    m_environment.setQuality(
-        isSource ? (hasBuildSystemInfo ? ClangParsingEnvironment::BuildSystem : ClangParsingEnvironment::Source)
-        : ClangParsingEnvironment::Unknown
-    );
-    m_environment.setTranslationUnitUrl(tuUrl);
-
-    Path::List projectPaths;
-    const auto& projects = ICore::self()->projectController()->projects();
-    projectPaths.reserve(projects.size());
-    foreach (auto project, projects) {
-        projectPaths.append(project->path());
+
+    m_unsavedFiles = clang()->unsavedFiles(&m_unsavedRevisions);
+}
+
+ClangParseJob::~ClangParseJob()
+{
+    QMutexLocker lock(&s_newestParseJobs->mutex);
+    auto it = s_newestParseJobs->jobs.find(m_environment.translationUnitUrl());
+    if (it != s_newestParseJobs->jobs.end() && it.value() == this) {
+        s_newestParseJobs->jobs.erase(it);
     }
-    m_environment.setProjectPaths(projectPaths);
+}
 
-    foreach(auto document, ICore::self()->documentController()->openDocuments()) {
-        auto textDocument = document->textDocument();
-        if (!textDocument || !textDocument->isModified() || !textDocument->url().isLocalFile()
-            || !DocumentFinderHelpers::mimeTypesList().contains(textDocument->mimeType()))
-        {
-            continue;
-        }
-        m_unsavedFiles << UnsavedFile(textDocument->url().toLocalFile(), textDocument->textLines(textDocument->documentRange()));
-        const IndexedString indexedUrl(textDocument->url());
-        m_unsavedRevisions.insert(indexedUrl, ModificationRevision::revisionForFile(indexedUrl));
+bool ClangParseJob::isSuperseded() const
+{
+    QMutexLocker lock(&s_newestParseJobs->mutex);
+    auto newest = s_newestParseJobs->jobs.value(m_environment.translationUnitUrl());
+    if (!newest || newest == this) {
+        return false;
     }
+    // a lower value is a better priority, don't wait for a newer job that runs after all others
+    if (newest->parsePriority() > parsePriority()) {
+        return false;
+    }
+    const auto missingFeatures = minimumFeatures() & ~newest->minimumFeatures() & TopDUContext::AllDeclarationsContextsUsesAndAST;
+    return !missingFeatures;
+}
+
+bool ClangParseJob::isObsolete() const
+{
+    return abortRequested() || isSuperseded();
 }
 
 ClangSupport* ClangParseJob::clang() const
@@ -222,15 +176,30 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread
 {
     QReadLocker parseLock(languageSupport()->parseLock());
 
-    if (abortRequested()) {
+    if (isObsolete()) {
         return;
     }
 
+    const auto parsingSettings = ClangSettingsManager::self()->parsingSettings();
+    clang()->index()->setTranslationUnitMemoryBudget(static_cast<quint64>(parsingSettings.tuMemoryBudget) * 1024 * 1024);
+
+    if (parsingSettings.twoTierIndexing && ClangIndexUpgrader::isProjectImport(this)
+        && !(minimumFeatures() & TopDUContext::AST) && !::hasTracker(document()))
     {
-        const auto tuUrlStr = m_environment.translationUnitUrl().str();
-        m_environment.addIncludes(IDefinesAndIncludesManager::manager()->includesInBackground(tuUrlStr));
-        m_environment.addDefines(IDefinesAndIncludesManager::manager()->definesInBackground(tuUrlStr));
-        m_environment.setPchInclude(userDefinedPchIncludeForFile(tuUrlStr));
+        // first tier of the project indexing: only build the declarations, the ClangIndexUpgrader adds the uses later
+        setMinimumFeatures(static_cast<TopDUContext::Features>(
+            (minimumFeatures() & ~TopDUContext::AllDeclarationsContextsAndUses) | TopDUContext::VisibleDeclarationsAndContexts));
+    }
+
+    bool sharedPch = false;
+    {
+        ClangProfiler::Scope profile("includesInBackground", document().str(), m_projectName);
+        clang()->environmentCache()->addBackgroundEnvironment(&m_environment);
+        if (!m_environment.pchInclude().isValid() && ClangHelpers::isSource(m_environment.translationUnitUrl().str())) {
+            // precompile the includes this TU has in common with others, if any
+            sharedPch = true;
+            m_environment.setSharedPchInclude(clang()->index()->sharedPchInclude(m_environment));
+        }
     }
 
     if (abortRequested()) {
@@ -245,7 +214,8 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread
     }
 
     ParseSession session(findParseSession(document()));
-    if (abortRequested()) {
+    if (isObsolete()) {
+        // a newer job is parsing the newest snapshot, don't spend time on an outdated one
         return;
     }
 
@@ -260,7 +230,13 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread
         }
     }
 
-    if (!session.data() || !session.reparse(m_unsavedFiles, m_environment)) {
+    bool reparsed = false;
+    if (session.data()) {
+        ClangProfiler::Scope profile("reparse", document().str(), m_projectName);
+        reparsed = session.reparse(m_unsavedFiles, m_environment);
+    }
+    if (!reparsed) {
+        ClangProfiler::Scope profile("parse", document().str(), m_projectName);
         session.setData(createSessionData());
     }
 
@@ -283,27 +259,40 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread
         return;
     }
 
-    Imports imports = ClangHelpers::tuImports(session.unit());
+    if (sharedPch) {
+        clang()->index()->setIncludePrefix(m_environment, leadingIncludes(session.unit(), session.mainFile()));
+    }
+
+    Imports imports;
     IncludeFileContexts includedFiles;
-    if (auto pch = clang()->index()->pch(m_environment)) {
-        auto pchFile = pch->mapFile(session.unit());
-        includedFiles = pch->mapIncludes(session.unit());
-        includedFiles.insert(pchFile, pch->context());
-        auto tuFile = clang_getFile(session.unit(), m_environment.translationUnitUrl().byteArray().constData());
-        imports.insert(tuFile, { pchFile, CursorInRevision(0, 0) } );
+    {
+        ClangProfiler::Scope profile("tuImports", document().str(), m_projectName);
+        imports = ClangHelpers::tuImports(session.unit());
+        if (auto pch = clang()->index()->pch(m_environment)) {
+            auto pchFile = pch->mapFile(session.unit());
+            includedFiles = pch->mapIncludes(session.unit());
+            includedFiles.insert(pchFile, pch->context());
+            auto tuFile = clang_getFile(session.unit(), m_environment.translationUnitUrl().byteArray().constData());
+            imports.insert(tuFile, { pchFile, CursorInRevision(0, 0) } );
+        }
     }
 
     if (abortRequested()) {
         return;
     }
 
-    auto context = ClangHelpers::buildDUChain(session.mainFile(), imports, session,
-                                              minimumFeatures(), includedFiles, clang()->index());
-    setDuChain(context);
-
-    if (abortRequested()) {
+    ReferencedTopDUContext context;
+    {
+        ClangProfiler::Scope profile("buildDUChain", document().str(), m_projectName);
+        context = ClangHelpers::buildDUChain(session.mainFile(), imports, session,
+                                             minimumFeatures(), includedFiles, clang()->index(),
+                                             parsingSettings.builderThreads,
+                                             [this] { return isObsolete(); });
+    }
+    if (!context || abortRequested()) {
         return;
     }
+    setDuChain(context);
 
     {
         if (minimumFeatures() & TopDUContext::AST) {
@@ -344,6 +333,7 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread
                 DUChainWriteLocker lock;
                 context->setAst(IAstContainer::Ptr(session.data()));
             }
+            ClangProfiler::Scope profile("highlighting", context->url().str(), m_projectName);
             languageSupport()->codeHighlighting()->highlightDUChain(context);
         }
     }
@@ -351,7 +341,9 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread
 
 ParseSessionData::Ptr ClangParseJob::createSessionData() const
 {
-    const bool skipFunctionBodies = (minimumFeatures() <= TopDUContext::VisibleDeclarationsAndContexts);
+    // ignore the update and rescheduling flags
+    const auto features = minimumFeatures() & TopDUContext::AllDeclarationsContextsUsesAndAST;
+    const bool skipFunctionBodies = (features <= TopDUContext::VisibleDeclarationsAndContexts);
     return ParseSessionData::Ptr(new ParseSessionData(m_unsavedFiles, clang()->index(), m_environment,
                                  (skipFunctionBodies ? ParseSessionData::SkipFunctionBodies : ParseSessionData::NoOption)));
 }
@@ -37,6 +37,7 @@ class ClangParseJob : public KDevelop::ParseJob
 public:
     ClangParseJob(const KDevelop::IndexedString& url,
                   KDevelop::ILanguageSupport* languageSupport);
+    ~ClangParseJob() override;
 
     ClangSupport* clang() const;
 
@@ -48,7 +49,19 @@ protected:
 private:
     QExplicitlySharedDataPointer<ParseSessionData> createSessionData() const;
 
+    /**
+     * @returns true when a newer parse job for the same translation unit exists, which provides at least our features
+     *          and has at least our priority
+     *
+     * That job parses a newer snapshot of the unsaved files, so parsing in this job is obsolete.
+     */
+    bool isSuperseded() const;
+    /// abortRequested() or isSuperseded()
+    bool isObsolete() const;
+
     ClangParsingEnvironment m_environment;
+    /// name of the project containing the translation unit, used for profiling
+    QString m_projectName;
     QVector<UnsavedFile> m_unsavedFiles;
     QHash<KDevelop::IndexedString, KDevelop::ModificationRevision> m_unsavedRevisions;
 };
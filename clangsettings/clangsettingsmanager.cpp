@@ -48,6 +48,11 @@ namespace
 
     const QString forwardDeclare = QStringLiteral("forwardDeclare");
 
+    // not in the settings dialog, see ParsingSettings::builderThreads
+    const QString builderThreads = QStringLiteral("builderThreads");
+    const QString tuMemoryBudget = QStringLiteral("tuMemoryBudget");
+    const QString twoTierIndexing = QStringLiteral("twoTierIndexing");
+
 AssistantsSettings readAssistantsSettings(KConfig* cfg)
 {
     auto grp = cfg->group(settingsGroup);
@@ -68,6 +73,18 @@ CodeCompletionSettings readCodeCompletionSettings(KConfig* cfg)
 
     return settings;
 }
+
+ParsingSettings readParsingSettings(KConfig* cfg)
+{
+    auto grp = cfg->group(settingsGroup);
+    ParsingSettings settings;
+
+    settings.builderThreads = qMax(1, grp.readEntry(builderThreads, 1));
+    settings.tuMemoryBudget = qMax(0, grp.readEntry(tuMemoryBudget, 2048));
+    settings.twoTierIndexing = grp.readEntry(twoTierIndexing, false);
+
+    return settings;
+}
 }
 
 ClangSettingsManager* ClangSettingsManager::self()
@@ -95,6 +112,12 @@ CodeCompletionSettings ClangSettingsManager::codeCompletionSettings() const
     return readCodeCompletionSettings(cfg.data());
 }
 
+ParsingSettings ClangSettingsManager::parsingSettings() const
+{
+    auto cfg = ICore::self()->activeSession()->config();
+    return readParsingSettings(cfg.data());
+}
+
 ParserSettings ClangSettingsManager::parserSettings(KDevelop::ProjectBaseItem* item) const
 {
     Q_ASSERT(QThread::currentThread() == qApp->thread());
@@ -55,6 +55,21 @@ struct AssistantsSettings
     bool forwardDeclare = true;
 };
 
+struct ParsingSettings
+{
+    /**
+     * Maximum number of threads used to build the DUChain of the files included by a single TU
+     *
+     * Only for development, it can only be set in the config file: libclang makes no thread-safety
+     * guarantee for concurrent cursor access on a single TU.
+     */
+    int builderThreads = 1;
+    /// Memory budget in MiB for the translation units kept alive for open documents, 0 means unlimited
+    int tuMemoryBudget = 2048;
+    /// Index project files without function bodies and uses first, and add their uses later when idle
+    bool twoTierIndexing = false;
+};
+
 class ClangSettingsManager
 {
 public:
@@ -64,6 +79,8 @@ public:
 
     CodeCompletionSettings codeCompletionSettings() const;
 
+    ParsingSettings parsingSettings() const;
+
     ParserSettings parserSettings(KDevelop::ProjectBaseItem* item) const;
 
 private:
@@ -71,6 +88,7 @@ private:
 
     bool m_enableTesting = false;
     friend class TestCodeCompletion;
+    friend class BenchCodeCompletion;
 };
 
 #endif // CLANGSETTINGSMANAGER_H
@@ -27,19 +27,26 @@
 #include "version.h"
 
 #include "util/clangdebug.h"
+#include "util/clangprofiler.h"
 #include "util/clangtypes.h"
 
 #include "codecompletion/model.h"
 
 #include "clanghighlighting.h"
+#include "clangenvironmentcache.h"
+#include "clangindexupgrader.h"
 
 #include "refactoring/kdevrefactorings.h"
 
 #include <interfaces/icore.h>
+#include <interfaces/idocument.h>
 #include <interfaces/ilanguagecontroller.h>
 #include <interfaces/iplugincontroller.h>
 #include <interfaces/contextmenuextension.h>
 #include <interfaces/idocumentcontroller.h>
+#include <interfaces/iproject.h>
+#include <interfaces/iprojectcontroller.h>
+#include <interfaces/isession.h>
 #include <language/interfaces/iastcontainer.h>
 
 #include "codegen/simplerefactoring.h"
@@ -52,6 +59,7 @@
 #include "duchain/duchainutils.h"
 
 #include <language/assistant/staticassistantsmanager.h>
+#include <language/backgroundparser/backgroundparser.h>
 #include <language/assistant/renameassistant.h>
 #include <language/codecompletion/codecompletion.h>
 #include <language/highlighting/codehighlighting.h>
@@ -66,10 +74,13 @@
 #include "clangsettings/sessionsettings/sessionsettings.h"
 
 #include <KActionCollection>
+#include <KTextEditor/Document>
 #include <KPluginFactory>
 
 #include <QAction>
+#include <QCoreApplication>
 #include <QRegularExpression>
+#include <QThread>
 
 K_PLUGIN_FACTORY_WITH_JSON(KDevClangSupportFactory, "kdevclangsupport.json", registerPlugin<ClangSupport>(); )
 
@@ -210,6 +221,17 @@ QPair<TopDUContextPointer, Use> macroExpansionForPosition(const QUrl &url, const
     return {{}, Use()};
 }
 
+/**
+ * Parse priorities of the documents around the active one, lower values get parsed first.
+ *
+ * Project files keep the priority assigned by the project controller and thus get parsed last.
+ */
+enum ParsePriority {
+    VisibleDocumentPriority = BackgroundParser::BestPriority,
+    BuddyPriority,
+    OpenDocumentPriority
+};
+
 }
 
 ClangSupport::ClangSupport(QObject* parent, const QVariantList& )
@@ -219,6 +241,8 @@ ClangSupport::ClangSupport(QObject* parent, const QVariantList& )
     , m_refactoring(nullptr)
     , m_index(nullptr)
     , m_refactoringsGlue(nullptr)
+    , m_indexUpgrader(nullptr)
+    , m_environmentCache(nullptr)
 {
     KDEV_USE_EXTENSION_INTERFACE( KDevelop::ILanguageSupport )
     setXMLFile( QStringLiteral("kdevclangsupport.rc") );
@@ -228,9 +252,29 @@ ClangSupport::ClangSupport(QObject* parent, const QVariantList& )
     m_highlighting = new ClangHighlighting(this);
     m_refactoring = new SimpleRefactoring(this);
     m_index.reset(new ClangIndex);
+    m_index->setPchDirectory(core()->activeSession()->pluginDataArea(this) + QStringLiteral("/pch"));
+    // only project directories are watched to keep the results of translationUnitForUrl up to date
+    auto projectController = core()->projectController();
+    auto updateProjectPaths = [this, projectController] {
+        Path::List projectPaths;
+        foreach (auto project, projectController->projects()) {
+            projectPaths.append(project->path());
+        }
+        m_index->setProjectPaths(projectPaths);
+    };
+    updateProjectPaths();
+    connect(projectController, &IProjectController::projectOpened, this, updateProjectPaths);
+    connect(projectController, &IProjectController::projectClosed, this, updateProjectPaths);
     m_refactoringsGlue = new KDevRefactorings(this);
-
-    new KDevelop::CodeCompletion( this, new ClangCodeCompletionModel(m_index.data(), this), name() );
+    m_indexUpgrader = new ClangIndexUpgrader(this);
+    m_environmentCache = new ClangEnvironmentCache(this);
+
+    auto completionModel = new ClangCodeCompletionModel(m_index.data(), this);
+    completionModel->setUnsavedFilesProvider([this] {
+        QHash<IndexedString, ModificationRevision> revisions;
+        return unsavedFiles(&revisions);
+    });
+    new KDevelop::CodeCompletion( this, completionModel, name() );
     for(const auto& type : DocumentFinderHelpers::mimeTypesList()){
         KDevelop::IBuddyDocumentFinder::addFinder(type, this);
     }
@@ -238,6 +282,9 @@ ClangSupport::ClangSupport(QObject* parent, const QVariantList& )
     auto assistantsManager = core()->languageController()->staticAssistantsManager();
     assistantsManager->registerAssistant(StaticAssistant::Ptr(new RenameAssistant(this)));
     assistantsManager->registerAssistant(StaticAssistant::Ptr(new AdaptSignatureAssistant(this)));
+
+    connect(core()->documentController(), &IDocumentController::documentActivated,
+            this, &ClangSupport::updateParsePriorities);
 }
 
 ClangSupport::~ClangSupport()
@@ -251,6 +298,8 @@ ClangSupport::~ClangSupport()
     }
 
     ClangIntegration::DUChainUtils::unregisterDUChainItems();
+
+    ClangProfiler::flush();
 }
 
 KDevelop::ConfigPage* ClangSupport::configPage(int number, QWidget* parent)
@@ -288,6 +337,81 @@ ClangIndex* ClangSupport::index()
     return m_index.data();
 }
 
+ClangEnvironmentCache* ClangSupport::environmentCache()
+{
+    return m_environmentCache;
+}
+
+QVector<UnsavedFile> ClangSupport::unsavedFiles(QHash<IndexedString, ModificationRevision>* revisions)
+{
+    QVector<UnsavedFile> unsavedFiles;
+
+    Q_ASSERT(QThread::currentThread() == qApp->thread());
+
+    QHash<IndexedString, UnsavedSnapshot> snapshots;
+    foreach(auto document, ICore::self()->documentController()->openDocuments()) {
+        auto textDocument = document->textDocument();
+        if (!textDocument || !textDocument->isModified() || !textDocument->url().isLocalFile()
+            || !DocumentFinderHelpers::mimeTypesList().contains(textDocument->mimeType()))
+        {
+            continue;
+        }
+        const IndexedString indexedUrl(textDocument->url());
+        const auto revision = ModificationRevision::revisionForFile(indexedUrl);
+        auto it = m_unsavedSnapshots.constFind(indexedUrl);
+        UnsavedSnapshot snapshot;
+        if (it != m_unsavedSnapshots.constEnd() && it->revision == revision) {
+            snapshot = *it;
+        } else {
+            // only encode documents that changed since the last parse job
+            snapshot = {revision, UnsavedFile(textDocument->url().toLocalFile(), textDocument->text().toUtf8() + '\n')};
+        }
+        unsavedFiles << snapshot.file;
+        revisions->insert(indexedUrl, revision);
+        snapshots.insert(indexedUrl, snapshot);
+    }
+    // drop the snapshots of documents that got saved or closed
+    m_unsavedSnapshots = snapshots;
+
+    return unsavedFiles;
+}
+
+void ClangSupport::updateParsePriorities()
+{
+    auto parser = core()->languageController()->backgroundParser();
+    auto prioritize = [parser] (const IndexedString& url, int priority) {
+        // only move documents that wait for a parse anyways, don't trigger new parse jobs
+        if (parser->isQueued(url) && parser->priorityForDocument(url) > priority) {
+            parser->addDocument(url, TopDUContext::VisibleDeclarationsAndContexts, priority);
+        }
+    };
+
+    auto activeDocument = core()->documentController()->activeDocument();
+    const auto activeUrl = activeDocument ? IndexedString(activeDocument->url()) : IndexedString();
+    const auto activeTu = activeUrl.isEmpty() ? IndexedString() : m_index->translationUnitForUrl(activeUrl);
+
+    foreach(auto document, core()->documentController()->openDocuments()) {
+        auto textDocument = document->textDocument();
+        if (!textDocument || !DocumentFinderHelpers::mimeTypesList().contains(textDocument->mimeType())) {
+            continue;
+        }
+        const IndexedString url(textDocument->url());
+        // open headers pinned to the TU of the active document get parsed along with it
+        const bool pinned = !activeTu.isEmpty() && m_index->translationUnitForUrl(url) == activeTu;
+        prioritize(url, pinned ? BuddyPriority : OpenDocumentPriority);
+    }
+
+    if (activeUrl.isEmpty()) {
+        return;
+    }
+
+    foreach(const auto& buddy, getPotentialBuddies(activeUrl.toUrl())) {
+        prioritize(IndexedString(buddy), BuddyPriority);
+    }
+    prioritize(activeTu, VisibleDocumentPriority);
+    prioritize(activeUrl, VisibleDocumentPriority);
+}
+
 bool ClangSupport::areBuddies(const QUrl &url1, const QUrl& url2)
 {
     return DocumentFinderHelpers::areBuddies(url1, url2);
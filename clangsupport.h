@@ -27,11 +27,17 @@
 #include <interfaces/iplugin.h>
 #include <language/interfaces/ilanguagesupport.h>
 #include <interfaces/ibuddydocumentfinder.h>
+#include <language/editor/modificationrevision.h>
+#include <serialization/indexedstring.h>
+
+#include "duchain/unsavedfile.h"
 
 #include <QStringList>
 #include <QVariantList>
 
+class ClangEnvironmentCache;
 class ClangIndex;
+class ClangIndexUpgrader;
 class SimpleRefactoring;
 class KDevRefactorings;
 
@@ -63,6 +69,18 @@ public:
 
     ClangIndex* index();
 
+    ClangEnvironmentCache* environmentCache();
+
+    /**
+     * @returns the contents of all modified open documents and stores their revisions in @p revisions
+     *
+     * The UTF-8 encoded contents are cached, documents that did not change since the last
+     * call are shared with earlier parse jobs instead of being encoded again.
+     * This accesses the open documents, only call it from the main thread, like the
+     * ClangParseJob constructor and the code completion model do.
+     */
+    QVector<UnsavedFile> unsavedFiles(QHash<KDevelop::IndexedString, KDevelop::ModificationRevision>* revisions);
+
     KDevelop::TopDUContext* standardContext(const QUrl &url, bool proxyContext = false) override;
 
     virtual KDevelop::ConfigPage* configPage(int number, QWidget *parent) override;
@@ -78,10 +96,25 @@ public:
     //END IBuddyDocumentFinder
 
 private:
+    /**
+     * Reorder the queued parse jobs such that the active document and its TU get parsed first,
+     * followed by its buddies and the documents pinned to the same TU, and then all other open documents.
+     */
+    void updateParsePriorities();
+
     KDevelop::ICodeHighlighting *m_highlighting;
     SimpleRefactoring *m_refactoring;
     QScopedPointer<ClangIndex> m_index;
     KDevRefactorings *m_refactoringsGlue;
+    ClangIndexUpgrader *m_indexUpgrader;
+    ClangEnvironmentCache *m_environmentCache;
+
+    struct UnsavedSnapshot
+    {
+        KDevelop::ModificationRevision revision;
+        UnsavedFile file;
+    };
+    QHash<KDevelop::IndexedString, UnsavedSnapshot> m_unsavedSnapshots;
 };
 
 #endif
@@ -50,7 +50,15 @@
 #include "../duchain/navigationwidget.h"
 #include "../clangsettings/clangsettingsmanager.h"
 
+#include <algorithm>
 #include <memory>
+#include <vector>
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
 
 #include <KTextEditor/Document>
 #include <KTextEditor/View>
@@ -60,6 +68,16 @@ using namespace KDevelop;
 namespace {
 /// Maximum return-type string length in completion items
 const int MAX_RETURN_TYPE_STRING_LENGTH = 20;
+/// Maximum number of items created for the results matching the filter prefix
+const int MAX_RANKED_RESULTS = 500;
+/// Minimum length of the filter prefix to limit the items to MAX_RANKED_RESULTS, shorter ones match too much
+const int MIN_LIMITING_PREFIX_LENGTH = 3;
+/// Number of results to create items for before the first batch of streamed items is reported
+const int FIRST_BATCH_SIZE = 100;
+/// Minimum number of results to create their items concurrently
+const int PARALLEL_RESULTS_THRESHOLD = 1000;
+/// Maximum number of threads creating completion items
+const int MAX_COMPLETION_THREADS = 4;
 
 /// Priority of code-completion results. NOTE: Keep in sync with Clang code base.
 enum CodeCompletionPriority {
@@ -448,7 +466,7 @@ bool isValidSpecialCompletionIdentifier(const QualifiedIdentifier& identifier)
     return false;
 }
 
-Declaration* findDeclaration(const QualifiedIdentifier& qid, const DUContextPointer& ctx, const CursorInRevision& position, QSet<Declaration*>& handled)
+Declaration* findDeclaration(const QualifiedIdentifier& qid, DUContext* ctx, const CursorInRevision& position, QSet<Declaration*>& handled)
 {
     PersistentSymbolTable::Declarations decl = PersistentSymbolTable::self().getDeclarations(qid);
 
@@ -475,7 +493,7 @@ Declaration* findDeclaration(const QualifiedIdentifier& qid, const DUContextPoin
 }
 
 /// If any parent of this context is a class, the closest class declaration is returned, nullptr otherwise
-Declaration* classDeclarationForContext(const DUContextPointer& context, const CursorInRevision& position)
+Declaration* classDeclarationForContext(DUContext* context, const CursorInRevision& position)
 {
     auto parent = context;
     while (parent) {
@@ -504,6 +522,393 @@ Declaration* classDeclarationForContext(const DUContextPointer& context, const C
     return parent ? parent->owner() : nullptr;
 }
 
+/**
+ * The texts of a completion result, as needed for its completion item
+ */
+struct CompletionTexts
+{
+    /// the string that would be needed to type, usually the identifier of something. Also used as name for code completion declaration items.
+    QString typed;
+    /// the display string used in the simple code completion items, including the function signature.
+    QString display;
+    /// the return type of a function e.g.
+    QString resultType;
+    /// the replacement text when an item gets executed
+    QString replacement;
+};
+
+/**
+ * Decode the texts of @p completionString
+ *
+ * Only the chunks which end up in one of the texts get decoded. For declarations, only the
+ * result type and the typed text are needed, as the function signature is taken from the
+ * declaration. Also adding the function signature to the "display" would break the "Detailed completion" option.
+ */
+CompletionTexts completionTexts(CXCompletionString completionString, bool isDeclaration)
+{
+    CompletionTexts texts;
+
+    auto chunkText = [completionString] (uint chunk) {
+        return ClangString(clang_getCompletionChunkText(completionString, chunk)).toString();
+    };
+
+    //BEGIN function signature parsing
+    // nesting depth of parentheses
+    int parenDepth = 0;
+    enum FunctionSignatureState {
+        // not yet inside the function signature
+        Before,
+        // any token is part of the function signature now
+        Inside,
+        // finished parsing the function signature
+        After
+    };
+    // current state
+    FunctionSignatureState signatureState = Before;
+    //END function signature parsing
+    const uint chunks = clang_getNumCompletionChunks(completionString);
+    for (uint j = 0; j < chunks; ++j) {
+        const auto kind = clang_getCompletionChunkKind(completionString, j);
+        if (kind == CXCompletionChunk_CurrentParameter || kind == CXCompletionChunk_Optional) {
+            continue;
+        }
+
+        if (isDeclaration && !texts.typed.isEmpty()) {
+            break;
+        }
+
+        switch (kind) {
+            case CXCompletionChunk_TypedText:
+                texts.typed = chunkText(j);
+                texts.display += texts.typed;
+                texts.replacement = texts.typed;
+                break;
+            case CXCompletionChunk_ResultType:
+                texts.resultType = chunkText(j);
+                break;
+            case CXCompletionChunk_Placeholder:
+                //TODO:consider KTextEditor::TemplateInterface possibility
+                //replacement += "/*" + string + "*/";
+                if (signatureState == Inside) {
+                    texts.display += chunkText(j);
+                }
+                break;
+            case CXCompletionChunk_LeftParen:
+                if (signatureState == Before && !parenDepth) {
+                    signatureState = Inside;
+                }
+                parenDepth++;
+                if (signatureState == Inside) {
+                    texts.display += QLatin1Char('(');
+                }
+                break;
+            case CXCompletionChunk_RightParen:
+                --parenDepth;
+                if (signatureState == Inside) {
+                    texts.display += QLatin1Char(')');
+                    if (!parenDepth) {
+                        signatureState = After;
+                    }
+                }
+                break;
+            default:
+                if (signatureState == Inside) {
+                    texts.display += chunkText(j);
+                }
+                break;
+        }
+    }
+
+    return texts;
+}
+
+/// @return the index of the typed text chunk of @p completionString, or -1
+int typedTextChunk(CXCompletionString completionString)
+{
+    const uint chunks = clang_getNumCompletionChunks(completionString);
+    for (uint j = 0; j < chunks; ++j) {
+        if (clang_getCompletionChunkKind(completionString, j) == CXCompletionChunk_TypedText) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+/// @return the FuzzyMatcher::score of the typed text of @p completionString, without decoding it
+int typedTextScore(CXCompletionString completionString, const FuzzyMatcher& matcher)
+{
+    const int chunk = typedTextChunk(completionString);
+    if (chunk == -1) {
+        return -1;
+    }
+    const ClangString text(clang_getCompletionChunkText(completionString, chunk));
+    return matcher.score(text.c_str(), qstrlen(text.c_str()));
+}
+
+/// @return a hash of the typed text of @p completionString, without decoding it
+uint typedTextHash(CXCompletionString completionString)
+{
+    const int chunk = typedTextChunk(completionString);
+    if (chunk == -1) {
+        return 0;
+    }
+    const ClangString text(clang_getCompletionChunkText(completionString, chunk));
+    return qHash(QByteArray::fromRawData(text.c_str(), qstrlen(text.c_str())));
+}
+
+/// A clang completion result to create an item for
+struct RankedResult
+{
+    uint index;
+    /// the higher the better, only set when filtering for a prefix or streaming the items
+    int rank;
+    /// the match quality of its item when filtering for a prefix, otherwise -1
+    int matchQuality;
+    /// the hash of its typed text, only set when filtering for a prefix or streaming the items
+    uint nameHash;
+    /// the ItemBuilder creating its item, see ClangCodeCompletionContext::completionItems
+    int shard;
+};
+
+/// @return the rank of a result with the FuzzyMatcher @p matchScore and the clang @p completionPriority
+int rankResult(int matchScore, unsigned int completionPriority)
+{
+    // the match score dominates, the priority still outweighs e.g. a case mismatch
+    return matchScore * 4 + codeCompletionPriorityToMatchQuality(completionPriority);
+}
+
+/// @return the match quality, from 0 to 10, of a result with the @p rank computed by rankResult() for @p matcher
+int rankToMatchQuality(int rank, const FuzzyMatcher& matcher)
+{
+    const int bestRank = rankResult(matcher.maximumScore(), 0);
+    return qBound(0, rank * 10 / bestRank, 10);
+}
+
+/// The item created for a clang completion result
+struct CreatedItem
+{
+    enum Group {
+        Regular,
+        Special,
+        Macro,
+        Builtin
+    };
+
+    /// the position of the result in the ranked results, the items are added in this order
+    int order;
+    Group group;
+    CompletionTreeItemPointer item;
+    /// the declaration to pass to the look-ahead matcher, if any
+    Declaration* lookAheadDeclaration;
+    /// true to match the type of lookAheadDeclaration, false to add its look-ahead declarations
+    bool lookAheadMatch;
+};
+
+/**
+ * Creates the completion items for a shard of the clang completion results
+ *
+ * Overloads get paired with their declarations in the order of their results, hence
+ * all results with the same typed text must be passed to the same builder.
+ * The builders of different shards may be used concurrently, with the DUChain read locked.
+ */
+class ItemBuilder
+{
+public:
+    ItemBuilder(CXCodeCompleteResults* results, DUContext* context, const CursorInRevision& position,
+                Declaration* currentClassDeclaration)
+        : m_results(results)
+        , m_context(context)
+        , m_position(position)
+        , m_currentClassDeclaration(currentClassDeclaration)
+    {}
+
+    /// Creates the item for the @p candidate, which is at @p order in the ranked results
+    void build(const RankedResult& candidate, int order)
+    {
+        auto result = m_results->Results[candidate.index];
+
+        const auto availability = clang_getCompletionAvailability(result.CompletionString);
+        const bool isDeclaration = result.CursorKind != CXCursor_MacroDefinition && result.CursorKind != CXCursor_NotImplemented;
+
+        if (availability == CXAvailability_NotAccessible && (!isDeclaration || !m_currentClassDeclaration)) {
+            return;
+        }
+
+        auto texts = completionTexts(result.CompletionString, isDeclaration);
+        const auto& typed = texts.typed;
+        const auto& display = texts.display;
+        const auto& replacement = texts.replacement;
+        auto& resultType = texts.resultType;
+
+        if(typed.isEmpty()){
+            return;
+        }
+
+        // ellide text to the right for overly long result types (templates especially)
+        elideStringRight(resultType, MAX_RETURN_TYPE_STRING_LENGTH);
+
+        if (isDeclaration) {
+            QualifiedIdentifier qid;
+            ClangString parent(clang_getCompletionParent(result.CompletionString, nullptr));
+            if (parent.c_str() != nullptr) {
+                // most results share few parents, only parse their identifiers once
+                const QByteArray parentName = QByteArray::fromRawData(parent.c_str(), qstrlen(parent.c_str()));
+                auto it = m_parentIdentifiers.constFind(parentName);
+                if (it == m_parentIdentifiers.constEnd()) {
+                    it = m_parentIdentifiers.insert(QByteArray(parent.c_str()), QualifiedIdentifier(parent.toString()));
+                }
+                qid = *it;
+            }
+            qid.push(Identifier(typed));
+
+            if (!isValidCompletionIdentifier(qid)) {
+                return;
+            }
+
+            auto found = findDeclaration(qid, m_context, m_position, m_handled);
+
+            CompletionTreeItemPointer item;
+            Declaration* lookAheadDeclaration = nullptr;
+            bool lookAheadMatch = false;
+            if (found) {
+                // TODO: Bug in Clang: protected members from base classes not accessible in derived classes.
+                if (availability == CXAvailability_NotAccessible) {
+                    if (auto cl = dynamic_cast<ClassMemberDeclaration*>(found)) {
+                        if (cl->accessPolicy() != Declaration::Protected) {
+                            return;
+                        }
+
+                        auto declarationClassContext = classDeclarationForContext(found->context(), m_position);
+
+                        uint steps = 10;
+                        auto inheriters = DUChainUtils::getInheriters(declarationClassContext, steps);
+                        if(!inheriters.contains(m_currentClassDeclaration)){
+                            return;
+                        }
+                    } else {
+                        return;
+                    }
+                }
+
+                auto declarationItem = new DeclarationItem(found, display, resultType, replacement);
+
+                const unsigned int completionPriority = adjustPriorityForDeclaration(found, clang_getCompletionPriority(result.CompletionString));
+                const bool bestMatch = completionPriority <= CCP_SuperCompletion;
+
+                //don't set best match property for internal identifiers, also prefer declarations from current file
+                if (bestMatch && !typed.startsWith(QLatin1String("__")) ) {
+                    const int matchQuality = codeCompletionPriorityToMatchQuality(completionPriority);
+                    declarationItem->setMatchQuality(matchQuality);
+
+                    // TODO: LibClang missing API to determine expected code completion type.
+                    lookAheadMatch = true;
+                } else {
+                    declarationItem->setInheritanceDepth(completionPriority);
+                }
+                if (candidate.matchQuality >= 0) {
+                    // how well the filter prefix matches dominates, as for the order of the items
+                    declarationItem->setMatchQuality(candidate.matchQuality);
+                }
+                lookAheadDeclaration = found;
+                item = declarationItem;
+            } else {
+                // still, let's trust that Clang found something useful and put it into the completion result list
+                clangDebug() << "Could not find declaration for" << qid;
+                item = CompletionTreeItemPointer(new SimpleItem(display, resultType, replacement));
+            }
+
+            if (isValidSpecialCompletionIdentifier(qid)) {
+                // If it's a special completion identifier e.g. "operator=(const&)" and we don't have a declaration for it, don't add it into completion list, as this item is completely useless and pollutes the test case.
+                // This happens e.g. for "class A{}; a.|".  At | we have "operator=(const A&)" as a special completion identifier without a declaration.
+                if(item->declaration()){
+                    m_items.append({order, CreatedItem::Special, item, lookAheadDeclaration, lookAheadMatch});
+                }
+            } else {
+                m_items.append({order, CreatedItem::Regular, item, lookAheadDeclaration, lookAheadMatch});
+            }
+            return;
+        }
+
+        if (result.CursorKind == CXCursor_MacroDefinition) {
+            // TODO: grouping of macros and built-in stuff
+            static const QIcon icon = QIcon::fromTheme(QStringLiteral("code-macro"));
+            auto item = CompletionTreeItemPointer(new SimpleItem(display, resultType, replacement, icon));
+            m_items.append({order, CreatedItem::Macro, item, nullptr, false});
+        } else if (result.CursorKind == CXCursor_NotImplemented) {
+            auto item = CompletionTreeItemPointer(new SimpleItem(display, resultType, replacement));
+            m_items.append({order, CreatedItem::Builtin, item, nullptr, false});
+        }
+    }
+
+    /// @return the items created since the last call, in the order they were created
+    QVector<CreatedItem> takeItems()
+    {
+        QVector<CreatedItem> items;
+        items.swap(m_items);
+        return items;
+    }
+
+private:
+    CXCodeCompleteResults* m_results;
+    DUContext* m_context;
+    CursorInRevision m_position;
+    Declaration* m_currentClassDeclaration;
+    QSet<Declaration*> m_handled;
+    /// the identifiers of the completion parents, by their names
+    QHash<QByteArray, QualifiedIdentifier> m_parentIdentifiers;
+    QVector<CreatedItem> m_items;
+};
+
+class BuildItemsRunnable : public QRunnable
+{
+public:
+    BuildItemsRunnable(ItemBuilder& builder, const QVector<RankedResult>& candidates, int begin, int end,
+                       int shard, const QAtomicInt& abort, QSemaphore& done)
+        : m_builder(builder)
+        , m_candidates(candidates)
+        , m_begin(begin)
+        , m_end(end)
+        , m_shard(shard)
+        , m_abort(abort)
+        , m_done(done)
+    {
+    }
+
+    void run() override
+    {
+        {
+            DUChainReadLocker lock;
+            for (int i = m_begin; i < m_end && !m_abort.load(); ++i) {
+                if (m_candidates[i].shard == m_shard) {
+                    m_builder.build(m_candidates[i], i);
+                }
+            }
+        }
+        m_done.release();
+    }
+
+private:
+    ItemBuilder& m_builder;
+    const QVector<RankedResult>& m_candidates;
+    int m_begin;
+    int m_end;
+    int m_shard;
+    const QAtomicInt& m_abort;
+    QSemaphore& m_done;
+};
+
+/// The threads creating the items of large result sets, shared by all completion requests
+struct CompletionThreadPool
+{
+    CompletionThreadPool()
+    {
+        pool.setMaxThreadCount(MAX_COMPLETION_THREADS);
+    }
+
+    QThreadPool pool;
+};
+Q_GLOBAL_STATIC(CompletionThreadPool, s_completionThreadPool)
+
 class LookAheadItemMatcher
 {
 public:
@@ -668,21 +1073,39 @@ ClangCodeCompletionContext::ClangCodeCompletionContext(const DUContextPointer& c
                                                        const ParseSessionData::Ptr& sessionData,
                                                        const QUrl& url,
                                                        const KTextEditor::Cursor& position,
-                                                       const QString& text
+                                                       const QString& text,
+                                                       const QVector<UnsavedFile>& unsavedFiles
                                                       )
-    : CodeCompletionContext(context, text, CursorInRevision::castFromSimpleCursor(position), 0)
+    : ClangCodeCompletionContext(context, sessionData, url, position, text.toUtf8(), unsavedFiles)
+{
+}
+
+ClangCodeCompletionContext::ClangCodeCompletionContext(const DUContextPointer& context,
+                                                       const ParseSessionData::Ptr& sessionData,
+                                                       const QUrl& url,
+                                                       const KTextEditor::Cursor& position,
+                                                       const QByteArray& content,
+                                                       const QVector<UnsavedFile>& unsavedFiles
+                                                      )
+    : CodeCompletionContext(context, QString(), CursorInRevision::castFromSimpleCursor(position), 0)
     , m_results(nullptr, clang_disposeCodeCompleteResults)
     , m_parseSessionData(sessionData)
 {
     qRegisterMetaType<MemberAccessReplacer::Type>();
     const QByteArray file = url.toLocalFile().toUtf8();
     ParseSession session(m_parseSessionData);
+    if (!session.isCompletable()) {
+        if (unsavedFiles.isEmpty() && !content.isEmpty()) {
+            session.ensureCompletable({UnsavedFile(url.toLocalFile(), content)});
+        } else {
+            session.ensureCompletable(unsavedFiles);
+        }
+    }
     {
         const unsigned int completeOptions = clang_defaultCodeCompleteOptions();
 
         CXUnsavedFile unsaved;
         unsaved.Filename = file.constData();
-        const QByteArray content = m_text.toUtf8();
         unsaved.Contents = content.constData();
         unsaved.Length = content.size() + 1; // + \0-byte
 
@@ -754,6 +1177,9 @@ QList<CompletionTreeItemPointer> ClangCodeCompletionContext::completionItems(boo
 
     const auto ctx = DUContextPointer(m_duContext->findContextAt(m_position));
 
+    // the context may be reused for another prefix, see setFilterPrefix()
+    m_ungrouped.clear();
+
     /// Normal completion items, such as 'void Foo::foo()'
     QList<CompletionTreeItemPointer> items;
     /// Stuff like 'Foo& Foo::operator=(const Foo&)', etc. Not regularly used by our users.
@@ -763,18 +1189,22 @@ QList<CompletionTreeItemPointer> ClangCodeCompletionContext::completionItems(boo
     /// Builtins reported by Clang
     QList<CompletionTreeItemPointer> builtin;
 
-    QSet<Declaration*> handled;
-
     LookAheadItemMatcher lookAheadMatcher(TopDUContextPointer(ctx->topContext()));
 
     clangDebug() << "Clang found" << m_results->NumResults << "completion results";
 
+    const bool filtered = !m_prefixMatcher.isEmpty();
+    const bool streamed = bool(m_itemsReadyCallback);
+
+    QVector<RankedResult> candidates;
+    candidates.reserve(m_results->NumResults);
+    bool hasInaccessibleResults = false;
     for (uint i = 0; i < m_results->NumResults; ++i) {
         if (abort) {
             return {};
         }
 
-        auto result = m_results->Results[i];
+        const auto& result = m_results->Results[i];
 
         const auto availability = clang_getCompletionAvailability(result.CompletionString);
         if (availability == CXAvailability_NotAvailable) {
@@ -796,173 +1226,139 @@ QList<CompletionTreeItemPointer> ClangCodeCompletionContext::completionItems(boo
             continue;
         }
 
-        // If ctx is/inside the Class context, this represents that context.
-        auto currentClassContext = classDeclarationForContext(ctx, m_position);
-        if (availability == CXAvailability_NotAccessible && (!isDeclaration || !currentClassContext)) {
-            continue;
-        }
-
-        const uint chunks = clang_getNumCompletionChunks(result.CompletionString);
-
-        // the string that would be needed to type, usually the identifier of something. Also we use it as name for code completion declaration items.
-        QString typed;
-        // the display string we use in the simple code completion items, including the function signature.
-        QString display;
-        // the return type of a function e.g.
-        QString resultType;
-        // the replacement text when an item gets executed
-        QString replacement;
-        //BEGIN function signature parsing
-        // nesting depth of parentheses
-        int parenDepth = 0;
-        enum FunctionSignatureState {
-            // not yet inside the function signature
-            Before,
-            // any token is part of the function signature now
-            Inside,
-            // finished parsing the function signature
-            After
-        };
-        // current state
-        FunctionSignatureState signatureState = Before;
-        //END function signature parsing
-        for (uint j = 0; j < chunks; ++j) {
-            const auto kind = clang_getCompletionChunkKind(result.CompletionString, j);
-            if (kind == CXCompletionChunk_CurrentParameter || kind == CXCompletionChunk_Optional) {
+        int rank = 0;
+        int matchQuality = -1;
+        if (filtered) {
+            const int matchScore = typedTextScore(result.CompletionString, m_prefixMatcher);
+            if (matchScore < 0) {
                 continue;
             }
+            rank = rankResult(matchScore, clang_getCompletionPriority(result.CompletionString));
+            matchQuality = rankToMatchQuality(rank, m_prefixMatcher);
+        } else if (streamed) {
+            rank = codeCompletionPriorityToMatchQuality(clang_getCompletionPriority(result.CompletionString));
+        }
+        hasInaccessibleResults |= availability == CXAvailability_NotAccessible;
+        candidates.append({i, rank, matchQuality, 0, 0});
+    }
 
-            // We don't need function signature for declaration items, we can get it directly from the declaration. Also adding the function signature to the "display" would break the "Detailed completion" option.
-            if(isDeclaration && !typed.isEmpty()){
-                break;
-            }
-
-            const QString string = ClangString(clang_getCompletionChunkText(result.CompletionString, j)).toString();
-            switch (kind) {
-                case CXCompletionChunk_TypedText:
-                    display += string;
-                    typed = string;
-                    replacement = string;
-                    break;
-                case CXCompletionChunk_ResultType:
-                    resultType = string;
-                    continue;
-                case CXCompletionChunk_Placeholder:
-                    //TODO:consider KTextEditor::TemplateInterface possibility
-                    //replacement += "/*" + string + "*/";
-                    if (signatureState == Inside) {
-                        display += string;
-                    }
-                    continue;
-                case CXCompletionChunk_LeftParen:
-                    if (signatureState == Before && !parenDepth) {
-                        signatureState = Inside;
-                    }
-                    parenDepth++;
-                    break;
-                case CXCompletionChunk_RightParen:
-                    --parenDepth;
-                    if (signatureState == Inside && !parenDepth) {
-                        display += QLatin1Char(')');
-                        signatureState = After;
-                    }
-                    break;
-                default:
-                    break;
-            }
-            //replacement += string;
-            if (signatureState == Inside) {
-                display += string;
+    if (filtered || streamed) {
+        // all results with the same typed text get the rank of the best one, to keep them in their order
+        // overloads get paired with their declarations in that order, see ItemBuilder
+        QHash<uint, int> nameRanks;
+        nameRanks.reserve(candidates.size());
+        for (auto& candidate : candidates) {
+            candidate.nameHash = typedTextHash(m_results->Results[candidate.index].CompletionString);
+            auto it = nameRanks.find(candidate.nameHash);
+            if (it == nameRanks.end()) {
+                nameRanks.insert(candidate.nameHash, candidate.rank);
+            } else if (*it < candidate.rank) {
+                *it = candidate.rank;
             }
         }
-
-        if(typed.isEmpty()){
-            continue;
+        for (auto& candidate : candidates) {
+            candidate.rank = nameRanks.value(candidate.nameHash);
         }
 
-        // ellide text to the right for overly long result types (templates especially)
-        elideStringRight(resultType, MAX_RETURN_TYPE_STRING_LENGTH);
-
-        if (isDeclaration) {
-            const Identifier id(typed);
-            QualifiedIdentifier qid;
-            ClangString parent(clang_getCompletionParent(result.CompletionString, nullptr));
-            if (parent.c_str() != nullptr) {
-                qid = QualifiedIdentifier(parent.toString());
-            }
-            qid.push(id);
+        // create the items for the best ranked results first, and for long filter prefixes only for the best of them
+        // the editor filters the items further while typing, a short prefix would lose results matching the longer one
+        // equally ranked results keep their order
+        const bool limited = filtered && m_prefixMatcher.length() >= MIN_LIMITING_PREFIX_LENGTH
+                          && candidates.size() > MAX_RANKED_RESULTS;
+        const auto end = limited ? candidates.begin() + MAX_RANKED_RESULTS : candidates.end();
+        std::partial_sort(candidates.begin(), end, candidates.end(), [] (const RankedResult& lhs, const RankedResult& rhs) {
+            return lhs.rank != rhs.rank ? lhs.rank > rhs.rank : lhs.index < rhs.index;
+        });
+        candidates.erase(end, candidates.end());
+    }
 
-            if (!isValidCompletionIdentifier(qid)) {
-                continue;
+    // If ctx is/inside the Class context, this represents that context.
+    // Only needed for inaccessible results, and looked up upfront as the items may get created concurrently.
+    Declaration* currentClassDeclaration = hasInaccessibleResults ? classDeclarationForContext(ctx.data(), m_position) : nullptr;
+
+    // large result sets get split into shards, which get their items created concurrently
+    // the results with the same typed text share a shard, see ItemBuilder
+    const int maximumThreadCount = m_maximumThreadCount > 0 ? m_maximumThreadCount : MAX_COMPLETION_THREADS;
+    const int shards = candidates.size() >= PARALLEL_RESULTS_THRESHOLD ? qBound(1, QThread::idealThreadCount(), maximumThreadCount) : 1;
+    if (shards > 1) {
+        for (auto& candidate : candidates) {
+            const uint nameHash = (filtered || streamed) ? candidate.nameHash
+                                                         : typedTextHash(m_results->Results[candidate.index].CompletionString);
+            candidate.shard = nameHash % shards;
+        }
+    }
+    std::vector<ItemBuilder> builders(shards, ItemBuilder(m_results.get(), ctx.data(), m_position, currentClassDeclaration));
+
+    // abort gets set by another thread, the shards only see it through this flag
+    QAtomicInt shardsAborted;
+
+    int begin = 0;
+    int nextBatch = FIRST_BATCH_SIZE;
+    while (begin < candidates.size()) {
+        const int end = streamed ? qMin(nextBatch, candidates.size()) : candidates.size();
+        if (shards > 1) {
+            QSemaphore done;
+            for (int shard = 0; shard < shards; ++shard) {
+                s_completionThreadPool->pool.start(new BuildItemsRunnable(builders[shard], candidates, begin, end,
+                                                                          shard, shardsAborted, done));
             }
-
-            auto found = findDeclaration(qid, ctx, m_position, handled);
-
-            CompletionTreeItemPointer item;
-            if (found) {
-                // TODO: Bug in Clang: protected members from base classes not accessible in derived classes.
-                if (availability == CXAvailability_NotAccessible) {
-                    if (auto cl = dynamic_cast<ClassMemberDeclaration*>(found)) {
-                        if (cl->accessPolicy() != Declaration::Protected) {
-                            continue;
-                        }
-
-                        auto declarationClassContext = classDeclarationForContext(DUContextPointer(found->context()), m_position);
-
-                        uint steps = 10;
-                        auto inheriters = DUChainUtils::getInheriters(declarationClassContext, steps);
-                        if(!inheriters.contains(currentClassContext)){
-                            continue;
-                        }
-                    } else {
-                        continue;
-                    }
+            while (!done.tryAcquire(shards, 10)) {
+                if (abort) {
+                    shardsAborted.store(1);
                 }
+            }
+        } else {
+            for (int i = begin; i < end && !abort; ++i) {
+                builders.front().build(candidates[i], i);
+            }
+        }
 
-                auto declarationItem = new DeclarationItem(found, display, resultType, replacement);
-
-                const unsigned int completionPriority = adjustPriorityForDeclaration(found, clang_getCompletionPriority(result.CompletionString));
-                const bool bestMatch = completionPriority <= CCP_SuperCompletion;
+        if (abort) {
+            return {};
+        }
 
-                //don't set best match property for internal identifiers, also prefer declarations from current file
-                if (bestMatch && !found->indexedIdentifier().identifier().toString().startsWith(QLatin1String("__")) ) {
-                    const int matchQuality = codeCompletionPriorityToMatchQuality(completionPriority);
-                    declarationItem->setMatchQuality(matchQuality);
+        // merge the items of all shards, in the order of their results
+        QVector<CreatedItem> created;
+        for (auto& builder : builders) {
+            created += builder.takeItems();
+        }
+        if (shards > 1) {
+            std::sort(created.begin(), created.end(), [] (const CreatedItem& lhs, const CreatedItem& rhs) {
+                return lhs.order < rhs.order;
+            });
+        }
 
-                    // TODO: LibClang missing API to determine expected code completion type.
-                    lookAheadMatcher.addMatchedType(found->indexedType());
+        for (const auto& createdItem : created) {
+            if (createdItem.lookAheadDeclaration) {
+                if (createdItem.lookAheadMatch) {
+                    lookAheadMatcher.addMatchedType(createdItem.lookAheadDeclaration->indexedType());
                 } else {
-                    declarationItem->setInheritanceDepth(completionPriority);
-
-                    lookAheadMatcher.addDeclarations(found);
+                    lookAheadMatcher.addDeclarations(createdItem.lookAheadDeclaration);
                 }
-                item = declarationItem;
-            } else {
-                // still, let's trust that Clang found something useful and put it into the completion result list
-                clangDebug() << "Could not find declaration for" << qid;
-                item = CompletionTreeItemPointer(new SimpleItem(display, resultType, replacement));
             }
 
-            if (isValidSpecialCompletionIdentifier(qid)) {
-                // If it's a special completion identifier e.g. "operator=(const&)" and we don't have a declaration for it, don't add it into completion list, as this item is completely useless and pollutes the test case.
-                // This happens e.g. for "class A{}; a.|".  At | we have "operator=(const A&)" as a special completion identifier without a declaration.
-                if(item->declaration()){
-                    specialItems.append(item);
-                }
-            } else {
-                items.append(item);
+            switch (createdItem.group) {
+                case CreatedItem::Regular:
+                    items.append(createdItem.item);
+                    break;
+                case CreatedItem::Special:
+                    specialItems.append(createdItem.item);
+                    break;
+                case CreatedItem::Macro:
+                    macros.append(createdItem.item);
+                    break;
+                case CreatedItem::Builtin:
+                    builtin.append(createdItem.item);
+                    break;
             }
-            continue;
         }
 
-        if (result.CursorKind == CXCursor_MacroDefinition) {
-            // TODO: grouping of macros and built-in stuff
-            static const QIcon icon = QIcon::fromTheme(QStringLiteral("code-macro"));
-            auto item = CompletionTreeItemPointer(new SimpleItem(display, resultType, replacement, icon));
-            macros.append(item);
-        } else if (result.CursorKind == CXCursor_NotImplemented) {
-            auto item = CompletionTreeItemPointer(new SimpleItem(display, resultType, replacement));
-            builtin.append(item);
+        begin = end;
+        if (begin < candidates.size()) {
+            if (!m_itemsReadyCallback(items)) {
+                return {};
+            }
+            nextBatch *= 2;
         }
     }
 
@@ -1042,4 +1438,19 @@ void ClangCodeCompletionContext::setFilters(const ClangCodeCompletionContext::Co
     m_filters = filters;
 }
 
+void ClangCodeCompletionContext::setFilterPrefix(const QString& prefix)
+{
+    m_prefixMatcher = FuzzyMatcher(prefix);
+}
+
+void ClangCodeCompletionContext::setItemsReadyCallback(const ItemsReadyCallback& callback)
+{
+    m_itemsReadyCallback = callback;
+}
+
+void ClangCodeCompletionContext::setMaximumThreadCount(int count)
+{
+    m_maximumThreadCount = qBound(1, count, MAX_COMPLETION_THREADS);
+}
+
 #include "context.moc"
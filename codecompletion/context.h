@@ -28,9 +28,11 @@
 
 #include <clang-c/Index.h>
 
+#include <functional>
 #include <memory>
 
 #include "completionhelper.h"
+#include "fuzzymatcher.h"
 
 class ClangCodeCompletionContext : public KDevelop::CodeCompletionContext
 {
@@ -49,7 +51,20 @@ public:
                                const ParseSessionData::Ptr& sessionData,
                                const QUrl& url,
                                const KTextEditor::Cursor& position,
-                               const QString& text);
+                               const QString& text,
+                               const QVector<UnsavedFile>& unsavedFiles = {});
+    /**
+     * Same as above, but takes the UTF-8 encoded document @p contents, which are passed to clang without a copy
+     *
+     * @p unsavedFiles are only used when the translation unit has to be parsed again first,
+     * see ParseSession::ensureCompletable(). The document contents are used if they are empty.
+     */
+    ClangCodeCompletionContext(const KDevelop::DUContextPointer& context,
+                               const ParseSessionData::Ptr& sessionData,
+                               const QUrl& url,
+                               const KTextEditor::Cursor& position,
+                               const QByteArray& contents,
+                               const QVector<UnsavedFile>& unsavedFiles = {});
     ~ClangCodeCompletionContext();
 
     virtual QList<KDevelop::CompletionTreeItemPointer> completionItems(bool& abort, bool fullCompletion = true) override;
@@ -59,6 +74,37 @@ public:
     ContextFilters filters() const;
     void setFilters(const ContextFilters& filters);
 
+    /**
+     * Only create items for the clang results whose typed text matches @p prefix, see FuzzyMatcher
+     *
+     * This allows to reuse a context while the user types the identifier at its position.
+     * The items are then sorted by how well they match, combined with their clang priority, which
+     * also is their match quality. For long prefixes, they are only created for the best ranked results.
+     */
+    void setFilterPrefix(const QString& prefix);
+
+    /**
+     * Called with the items created so far, whenever another batch of them is ready
+     *
+     * @return false to abort creating the remaining items
+     */
+    using ItemsReadyCallback = std::function<bool(const QList<KDevelop::CompletionTreeItemPointer>& items)>;
+
+    /**
+     * Stream large result sets: create the items best first, by their clang priority,
+     * and report them to @p callback in growing batches while creating the rest
+     *
+     * The groups, e.g. for macros, are only added once all items are created.
+     */
+    void setItemsReadyCallback(const ItemsReadyCallback& callback);
+
+    /**
+     * Create the items of large result sets with at most @p count threads, 1 creates all of them in the calling thread
+     *
+     * By default as many threads as there are cores are used, up to a fixed maximum.
+     */
+    void setMaximumThreadCount(int count);
+
 private:
     void addOverwritableItems();
     void addImplementationHelperItems();
@@ -74,6 +120,9 @@ private:
     CompletionHelper m_completionHelper;
     ParseSessionData::Ptr m_parseSessionData;
     ContextFilters m_filters = NoFilter;
+    FuzzyMatcher m_prefixMatcher;
+    ItemsReadyCallback m_itemsReadyCallback;
+    int m_maximumThreadCount = 0;
 };
 
 #endif // CLANGCODECOMPLETIONCONTEXT_H
@@ -0,0 +1,100 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "contextcache.h"
+
+#include <cctype>
+#include <cstring>
+
+using namespace KDevelop;
+
+namespace {
+
+/// @return the byte offset of the start of @p line in the UTF-8 encoded @p contents
+int lineOffset(const QByteArray& contents, int line)
+{
+    const char* begin = contents.constData();
+    const char* end = begin + contents.size();
+    const char* lineStart = begin;
+    for (int i = 0; i < line && lineStart < end; ++i) {
+        auto newLine = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart));
+        lineStart = newLine ? newLine + 1 : end;
+    }
+    return lineStart - begin;
+}
+
+/// @return the byte offset of the end of the identifier starting at @p offset in the UTF-8 encoded @p contents
+int identifierEndOffset(const QByteArray& contents, int offset)
+{
+    while (offset < contents.size()) {
+        const uchar c = contents.at(offset);
+        if (!(std::isalnum(c) || c == '_' || c >= 0x80)) {
+            break;
+        }
+        ++offset;
+    }
+    return offset;
+}
+
+}
+
+CompletionContextKey::CompletionContextKey(const DUContextPointer& top, const ParseSessionData::Ptr& sessionData,
+                                           const QUrl& url, const KTextEditor::Cursor& position,
+                                           const QString& text, const QByteArray& contents)
+    : top(top)
+    , sessionData(sessionData)
+    // before the context gets created, a concurrent reparse then invalidates it
+    , sessionRevision(sessionData ? sessionData->revision() : 0)
+    , url(url)
+    , position(position)
+    , contents(contents)
+    , identifierStart(qMin(lineOffset(contents, position.line()) + text.toUtf8().size(), contents.size()))
+    , identifierEnd(identifierEndOffset(contents, identifierStart))
+{
+}
+
+bool CompletionContextKey::matches(const CompletionContextKey& other) const
+{
+    return url == other.url && position == other.position && top == other.top
+        && sessionData == other.sessionData && sessionRevision == other.sessionRevision
+        && equalsOutsideIdentifier(other.contents, other.identifierStart, other.identifierEnd);
+}
+
+bool CompletionContextKey::equalsOutsideIdentifier(const QByteArray& contents, int start, int end) const
+{
+    const int suffix = contents.size() - end;
+    return start == identifierStart && suffix == this->contents.size() - identifierEnd
+        && std::memcmp(contents.constData(), this->contents.constData(), start) == 0
+        && std::memcmp(contents.constData() + end, this->contents.constData() + identifierEnd, suffix) == 0;
+}
+
+QSharedPointer<ClangCodeCompletionContext> CompletionContextCache::find(const CompletionContextKey& key) const
+{
+    if (!m_context || !m_key.matches(key)) {
+        return {};
+    }
+    return m_context;
+}
+
+void CompletionContextCache::insert(const CompletionContextKey& key, const QSharedPointer<ClangCodeCompletionContext>& context)
+{
+    m_key = key;
+    m_context = context;
+}
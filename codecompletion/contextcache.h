@@ -0,0 +1,85 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLANGCOMPLETIONCONTEXTCACHE_H
+#define CLANGCOMPLETIONCONTEXTCACHE_H
+
+#include "duchain/parsesession.h"
+
+#include <language/duchain/ducontext.h>
+
+#include <KTextEditor/Cursor>
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QUrl>
+
+class ClangCodeCompletionContext;
+
+/**
+ * Identifies the code completion context of a completion request, see CompletionContextCache.
+ */
+struct CompletionContextKey
+{
+    CompletionContextKey() = default;
+    /**
+     * @param text The text of the line before the @p position
+     * @param contents The UTF-8 encoded contents of the document
+     */
+    CompletionContextKey(const KDevelop::DUContextPointer& top, const ParseSessionData::Ptr& sessionData,
+                         const QUrl& url, const KTextEditor::Cursor& position, const QString& text,
+                         const QByteArray& contents);
+
+    /// @return true if a context created for @p other can be reused for this request
+    bool matches(const CompletionContextKey& other) const;
+
+    /// @return true if @p contents only differs from the contents of this key in the identifier at the position
+    bool equalsOutsideIdentifier(const QByteArray& contents, int start, int end) const;
+
+    KDevelop::DUContextPointer top;
+    ParseSessionData::Ptr sessionData;
+    /// the revision of the session, reparsing it may change the results
+    int sessionRevision = 0;
+    QUrl url;
+    KTextEditor::Cursor position;
+    QByteArray contents;
+    /// the identifier at the position is found between these byte offsets in the contents
+    int identifierStart = 0;
+    int identifierEnd = 0;
+};
+
+/**
+ * The last clang code completion context, which is reused while the user only types the
+ * identifier at its position, as clang then returns the same results.
+ */
+class CompletionContextCache
+{
+public:
+    /// @return the cached context if it can be reused for @p key, otherwise a null pointer
+    QSharedPointer<ClangCodeCompletionContext> find(const CompletionContextKey& key) const;
+
+    void insert(const CompletionContextKey& key, const QSharedPointer<ClangCodeCompletionContext>& context);
+
+private:
+    CompletionContextKey m_key;
+    QSharedPointer<ClangCodeCompletionContext> m_context;
+};
+
+#endif // CLANGCOMPLETIONCONTEXTCACHE_H
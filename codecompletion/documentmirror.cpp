@@ -0,0 +1,76 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "documentmirror.h"
+
+#include <KTextEditor/Document>
+
+#include <cstring>
+
+DocumentMirror* DocumentMirror::forDocument(KTextEditor::Document* document)
+{
+    auto mirror = document->findChild<DocumentMirror*>(QString(), Qt::FindDirectChildrenOnly);
+    return mirror ? mirror : new DocumentMirror(document);
+}
+
+DocumentMirror::DocumentMirror(KTextEditor::Document* document)
+    : QObject(document)
+    , m_document(document)
+{
+    connect(document, &KTextEditor::Document::textInserted, this, &DocumentMirror::textInserted);
+    connect(document, &KTextEditor::Document::textRemoved, this, &DocumentMirror::textRemoved);
+    connect(document, &KTextEditor::Document::reloaded, this, &DocumentMirror::reset);
+    reset();
+}
+
+QByteArray DocumentMirror::contents() const
+{
+    return m_contents;
+}
+
+void DocumentMirror::reset()
+{
+    m_contents = m_document->text().toUtf8();
+}
+
+void DocumentMirror::textInserted(KTextEditor::Document* /*document*/, const KTextEditor::Cursor& position, const QString& text)
+{
+    m_contents.insert(offset(position), text.toUtf8());
+}
+
+void DocumentMirror::textRemoved(KTextEditor::Document* /*document*/, const KTextEditor::Range& range, const QString& text)
+{
+    m_contents.remove(offset(range.start()), text.toUtf8().size());
+}
+
+int DocumentMirror::offset(const KTextEditor::Cursor& position) const
+{
+    const char* begin = m_contents.constData();
+    const char* end = begin + m_contents.size();
+    const char* lineStart = begin;
+    for (int line = 0; line < position.line() && lineStart < end; ++line) {
+        auto newLine = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart));
+        lineStart = newLine ? newLine + 1 : end;
+    }
+    const auto linePrefix = m_document->line(position.line()).leftRef(position.column());
+    return (lineStart - begin) + linePrefix.toUtf8().size();
+}
+
+#include "moc_documentmirror.cpp"
@@ -0,0 +1,71 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLANGDOCUMENTMIRROR_H
+#define CLANGDOCUMENTMIRROR_H
+
+#include <QByteArray>
+#include <QObject>
+
+namespace KTextEditor {
+class Cursor;
+class Document;
+class Range;
+}
+
+/**
+ * Keeps a UTF-8 encoded copy of the contents of a document, updated incrementally on every edit.
+ *
+ * Code completion passes these contents to clang, instead of copying and encoding the whole
+ * document on every request.
+ */
+class DocumentMirror : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @returns the mirror of @p document, it is created on first use and destroyed with the document
+     */
+    static DocumentMirror* forDocument(KTextEditor::Document* document);
+
+    /**
+     * @returns the UTF-8 encoded contents of the document
+     *
+     * The returned byte array is implicitly shared, so this is cheap and the contents
+     * can safely be used from another thread while the document is edited.
+     */
+    QByteArray contents() const;
+
+private:
+    explicit DocumentMirror(KTextEditor::Document* document);
+
+    void reset();
+    void textInserted(KTextEditor::Document* document, const KTextEditor::Cursor& position, const QString& text);
+    void textRemoved(KTextEditor::Document* document, const KTextEditor::Range& range, const QString& text);
+
+    /// @returns the byte offset of @p position, whose line must be unchanged up to the position
+    int offset(const KTextEditor::Cursor& position) const;
+
+    KTextEditor::Document* m_document;
+    QByteArray m_contents;
+};
+
+#endif // CLANGDOCUMENTMIRROR_H
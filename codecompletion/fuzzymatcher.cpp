@@ -0,0 +1,151 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fuzzymatcher.h"
+
+#include <QtGlobal>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+enum ScoreBonus {
+    /// for a match right after the previous one, or at the start of the text
+    ConsecutiveBonus = 4,
+    /// for a match at the start of a word, e.g. the 'B' of fooBar or foo_bar
+    WordStartBonus = 3,
+    /// for a match with the same case as the pattern
+    CaseBonus = 1,
+    /// the maximum penalty for the characters of the text not in the pattern
+    MaxLengthPenalty = 4
+};
+
+inline char toLowerAscii(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+inline char toUpperAscii(char c)
+{
+    return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+inline bool isWordStart(const char* text, int pos)
+{
+    if (pos == 0) {
+        return true;
+    }
+    const char previous = text[pos - 1];
+    return previous == '_' || (previous >= 'a' && previous <= 'z' && text[pos] >= 'A' && text[pos] <= 'Z');
+}
+
+/// @return the position of the first occurrence of @p c at or after @p from in @p text, ignoring ASCII case, or -1
+int findNext(const char* text, int from, int length, char c)
+{
+    const char lower = toLowerAscii(c);
+    const char upper = toUpperAscii(c);
+#ifdef __SSE2__
+    const __m128i lowerMask = _mm_set1_epi8(lower);
+    const __m128i upperMask = _mm_set1_epi8(upper);
+    for (; from + 16 <= length; from += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + from));
+        const int found = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, lowerMask),
+                                                         _mm_cmpeq_epi8(chunk, upperMask)));
+        if (found) {
+            return from + __builtin_ctz(found);
+        }
+    }
+#endif
+    for (; from < length; ++from) {
+        if (text[from] == lower || text[from] == upper) {
+            return from;
+        }
+    }
+    return -1;
+}
+
+}
+
+FuzzyMatcher::FuzzyMatcher(const QString& pattern)
+    : m_pattern(pattern.toUtf8())
+{
+}
+
+bool FuzzyMatcher::isEmpty() const
+{
+    return m_pattern.isEmpty();
+}
+
+int FuzzyMatcher::length() const
+{
+    return m_pattern.size();
+}
+
+bool FuzzyMatcher::matches(const char* text, int length) const
+{
+    int pos = -1;
+    for (const char c : m_pattern) {
+        pos = findNext(text, pos + 1, length, c);
+        if (pos == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FuzzyMatcher::matches(const QByteArray& text) const
+{
+    return matches(text.constData(), text.size());
+}
+
+int FuzzyMatcher::score(const char* text, int length) const
+{
+    int score = 0;
+    int pos = -1;
+    for (const char c : m_pattern) {
+        const int previous = pos;
+        pos = findNext(text, pos + 1, length, c);
+        if (pos == -1) {
+            return -1;
+        }
+        if (pos == previous + 1) {
+            score += ConsecutiveBonus;
+        } else if (isWordStart(text, pos)) {
+            score += WordStartBonus;
+        }
+        if (text[pos] == c) {
+            score += CaseBonus;
+        }
+    }
+    score -= qMin(length - m_pattern.size(), static_cast<int>(MaxLengthPenalty));
+    return qMax(score, 0);
+}
+
+int FuzzyMatcher::score(const QByteArray& text) const
+{
+    return score(text.constData(), text.size());
+}
+
+int FuzzyMatcher::maximumScore() const
+{
+    return m_pattern.size() * (ConsecutiveBonus + CaseBonus);
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLANGFUZZYMATCHER_H
+#define CLANGFUZZYMATCHER_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Matches UTF-8 encoded identifiers against the prefix typed by the user.
+ *
+ * A text matches when all characters of the pattern appear in it in the same order,
+ * ASCII letters compare case-insensitively. This is more permissive than the filtering
+ * done by the editor, so no item the editor would show gets filtered out.
+ *
+ * The texts are scanned for the pattern characters with SSE2 where available.
+ */
+class FuzzyMatcher
+{
+public:
+    explicit FuzzyMatcher(const QString& pattern = {});
+
+    /// @return true if the pattern is empty, i.e. everything matches
+    bool isEmpty() const;
+
+    /// @return the length of the UTF-8 encoded pattern
+    int length() const;
+
+    /// @return true if @p text, of @p length bytes, matches the pattern
+    bool matches(const char* text, int length) const;
+    bool matches(const QByteArray& text) const;
+
+    /**
+     * @return how well @p text, of @p length bytes, matches the pattern, or -1 if it does not match
+     *
+     * The higher the better: consecutive matches, matches at the start of words
+     * and matches with the same case score higher, long texts score lower.
+     */
+    int score(const char* text, int length) const;
+    int score(const QByteArray& text) const;
+
+    /// @return the score of a text which equals the pattern, no text scores higher
+    int maximumScore() const;
+
+private:
+    /// the UTF-8 encoded pattern
+    QByteArray m_pattern;
+};
+
+#endif // CLANGFUZZYMATCHER_H
@@ -23,11 +23,17 @@
 
 #include "util/clangdebug.h"
 #include "context.h"
+#include "contextcache.h"
+#include "documentmirror.h"
 #include "includepathcompletioncontext.h"
 
 #include "duchain/parsesession.h"
 #include "duchain/clangindex.h"
 
+#include <interfaces/icore.h>
+#include <interfaces/ilanguagecontroller.h>
+#include <language/backgroundparser/backgroundparser.h>
+#include <language/backgroundparser/parsejob.h>
 #include <language/codecompletion/codecompletionworker.h>
 #include <language/duchain/topducontext.h>
 #include <language/duchain/duchainutils.h>
@@ -35,6 +41,7 @@
 
 #include <QRegularExpression>
 
+#include <KTextEditor/CodeCompletionInterface>
 #include <KTextEditor/View>
 #include <KTextEditor/Document>
 
@@ -44,13 +51,7 @@ namespace {
 
 bool includePathCompletionRequired(const QString& text)
 {
-    QString line;
-    const int idx = text.lastIndexOf(QLatin1Char('\n'));
-    if (idx != -1) {
-        line = text.mid(idx + 1).trimmed();
-    } else {
-        line = text.trimmed();
-    }
+    const QString line = text.trimmed();
 
     const static QRegularExpression includeRegExp(QStringLiteral("^\\s*#\\s*include"));
     if (!line.contains(includeRegExp)) {
@@ -60,20 +61,6 @@ bool includePathCompletionRequired(const QString& text)
     return true;
 }
 
-QSharedPointer<CodeCompletionContext> createCompletionContext(const DUContextPointer& context,
-                                                              const ParseSessionData::Ptr& session,
-                                                              const QUrl& url,
-                                                              const KTextEditor::Cursor& position,
-                                                              const QString& text,
-                                                              const QString& followingText)
-{
-    if (includePathCompletionRequired(text)) {
-        return QSharedPointer<IncludePathCompletionContext>::create(context, session, url, position, text);
-    } else {
-        return QSharedPointer<ClangCodeCompletionContext>::create(context, session, url, position, text + followingText);
-    }
-}
-
 class ClangCodeCompletionWorker : public CodeCompletionWorker
 {
     Q_OBJECT
@@ -84,8 +71,16 @@ public:
     {}
     virtual ~ClangCodeCompletionWorker() = default;
 
+signals:
+    /// Emitted when no AST is available to complete in @p url
+    void completionMissed(const QUrl& url);
+    /// Emitted when the AST of @p url has to be parsed again, which requires the unsaved documents
+    void unsavedFilesRequired(const QUrl& url);
+
 public slots:
-    void completionRequested(const QUrl &url, const KTextEditor::Cursor& position, const QString& text, const QString& followingText)
+    void completionRequested(const QUrl &url, const KTextEditor::Cursor& position, const QString& text,
+                             const QString& prefix, const QByteArray& contents,
+                             const QVector<UnsavedFile>& unsavedFiles)
     {
         aborting() = false;
 
@@ -98,6 +93,7 @@ public slots:
         auto top = DUChainUtils::standardContextForUrl(url);
         if (!top) {
             qCWarning(KDEV_CLANG) << "No context found for" << url;
+            emit completionMissed(url);
             return;
         }
 
@@ -116,8 +112,8 @@ public slots:
             }
         }
         if (!sessionData) {
-            // TODO: trigger reparse and re-request code completion
             qCWarning(KDEV_CLANG) << "No parse session / AST attached to context for url" << url;
+            emit completionMissed(url);
             return;
         }
 
@@ -126,7 +122,16 @@ public slots:
             return;
         }
 
-        auto completionContext = ::createCompletionContext(DUContextPointer(top), sessionData, url, position, text, followingText);
+        QSharedPointer<CodeCompletionContext> completionContext;
+        if (includePathCompletionRequired(text)) {
+            completionContext = QSharedPointer<IncludePathCompletionContext>::create(DUContextPointer(top), sessionData, url, position, text);
+        } else {
+            completionContext = clangCompletionContext(DUContextPointer(top), sessionData, url, position, text, prefix,
+                                                       contents, unsavedFiles);
+            if (!completionContext) {
+                return;
+            }
+        }
 
         lock.lock();
         if (aborting()) {
@@ -157,7 +162,47 @@ public slots:
         foundDeclarations( tree, {} );
     }
 private:
+    /**
+     * @return the cached code completion context, if only the identifier at @p position changed and the
+     * translation unit was not parsed again since it was created, otherwise a new one. A null pointer when the translation unit has to be parsed
+     * again and @p unsavedFiles are missing, unsavedFilesRequired() is emitted then.
+     */
+    QSharedPointer<ClangCodeCompletionContext> clangCompletionContext(const DUContextPointer& top,
+                                                                      const ParseSessionData::Ptr& sessionData,
+                                                                      const QUrl& url,
+                                                                      const KTextEditor::Cursor& position,
+                                                                      const QString& text,
+                                                                      const QString& prefix,
+                                                                      const QByteArray& contents,
+                                                                      const QVector<UnsavedFile>& unsavedFiles)
+    {
+        const CompletionContextKey key(top, sessionData, url, position, text, contents);
+        auto context = m_contextCache.find(key);
+        if (!context) {
+            if (unsavedFiles.isEmpty() && !ParseSession(sessionData).isCompletable()) {
+                // the unsaved documents can only be collected on the GUI thread, the parse itself must not run there
+                emit unsavedFilesRequired(url);
+                return {};
+            }
+            context = QSharedPointer<ClangCodeCompletionContext>::create(top, sessionData, url, position,
+                                                                         contents, unsavedFiles);
+            m_contextCache.insert(key, context);
+
+            // show the best items of large result sets right away, and keep appending the rest
+            context->setItemsReadyCallback([this] (const QList<CompletionTreeItemPointer>& items) {
+                if (aborting()) {
+                    return false;
+                }
+                foundDeclarations(computeGroups(items, {}), {});
+                return !aborting();
+            });
+        }
+        context->setFilterPrefix(prefix);
+        return context;
+    }
+
     ClangIndex* m_index;
+    CompletionContextCache m_contextCache;
 };
 }
 
@@ -166,6 +211,15 @@ ClangCodeCompletionModel::ClangCodeCompletionModel(ClangIndex* index, QObject* p
     , m_index(index)
 {
     qRegisterMetaType<KTextEditor::Cursor>();
+    qRegisterMetaType<QVector<UnsavedFile>>();
+
+    connect(ICore::self()->languageController()->backgroundParser(), &BackgroundParser::parseJobFinished,
+            this, &ClangCodeCompletionModel::parseJobFinished);
+}
+
+void ClangCodeCompletionModel::setUnsavedFilesProvider(const UnsavedFilesProvider& provider)
+{
+    m_unsavedFilesProvider = provider;
 }
 
 ClangCodeCompletionModel::~ClangCodeCompletionModel()
@@ -178,15 +232,93 @@ CodeCompletionWorker* ClangCodeCompletionModel::createCompletionWorker()
     auto worker = new ClangCodeCompletionWorker(m_index, this);
     connect(this, &ClangCodeCompletionModel::requestCompletion,
             worker, &ClangCodeCompletionWorker::completionRequested);
+    connect(worker, &ClangCodeCompletionWorker::completionMissed,
+            this, &ClangCodeCompletionModel::completionMissed);
+    connect(worker, &ClangCodeCompletionWorker::unsavedFilesRequired,
+            this, &ClangCodeCompletionModel::unsavedFilesRequired);
     return worker;
 }
 
 void ClangCodeCompletionModel::completionInvokedInternal(KTextEditor::View* view, const KTextEditor::Range& range,
                                                          CodeCompletionModel::InvocationType /*invocationType*/, const QUrl &url)
 {
-    auto text = view->document()->text({0, 0, range.start().line(), range.start().column()});
-    auto followingText = view->document()->text({{range.start().line(), range.start().column()}, view->document()->documentEnd()});
-    emit requestCompletion(url, KTextEditor::Cursor(range.start()), text, followingText);
+    m_view = view;
+    m_range = range;
+    m_url = url;
+    m_reissued = m_reissuing;
+
+    auto document = view->document();
+    m_text = document->line(range.start().line()).left(range.start().column());
+    // the range may extend over the rest of the identifier behind the cursor
+    m_prefix = document->text({range.start(), view->cursorPosition()});
+    m_contents = DocumentMirror::forDocument(document)->contents();
+    emit requestCompletion(url, KTextEditor::Cursor(range.start()), m_text, m_prefix, m_contents, {});
+}
+
+void ClangCodeCompletionModel::unsavedFilesRequired(const QUrl& url)
+{
+    if (url != m_url) {
+        return;
+    }
+
+    auto unsavedFiles = m_unsavedFilesProvider ? m_unsavedFilesProvider() : QVector<UnsavedFile>();
+    if (unsavedFiles.isEmpty()) {
+        // never pass an empty list, the worker would ask again
+        unsavedFiles.append(UnsavedFile(url.toLocalFile(), m_contents));
+    }
+    emit requestCompletion(url, KTextEditor::Cursor(m_range.start()), m_text, m_prefix, m_contents, unsavedFiles);
+}
+
+void ClangCodeCompletionModel::completionMissed(const QUrl& url)
+{
+    // don't loop when the reparse did not help
+    if (url != m_url || m_reissued) {
+        return;
+    }
+
+    auto parser = ICore::self()->languageController()->backgroundParser();
+    const IndexedString document(url);
+    // don't queue the same reparse twice, but retry when it got dropped from the queue without reporting back
+    if (url == m_reparsedUrl && (parser->isQueued(document) || parser->parseJobForDocument(document))) {
+        return;
+    }
+
+    m_reparsedUrl = url;
+    // the AST is only kept when it was requested explicitly, force the update as it may be dropped already
+    const auto features = static_cast<TopDUContext::Features>(TopDUContext::AllDeclarationsContextsUsesAndAST | TopDUContext::ForceUpdate);
+    parser->addDocument(document, features, BackgroundParser::BestPriority, this);
+}
+
+void ClangCodeCompletionModel::parseJobFinished(ParseJob* job)
+{
+    if (job->abortRequested() && job->document().toUrl() == m_reparsedUrl) {
+        m_reparsedUrl.clear();
+    }
+}
+
+void ClangCodeCompletionModel::updateReady(const IndexedString& url, const ReferencedTopDUContext& topContext)
+{
+    if (url.toUrl() != m_reparsedUrl) {
+        return;
+    }
+    m_reparsedUrl.clear();
+
+    // only re-issue the completion when the user is still waiting for it
+    if (!topContext.data() || !m_view || m_view->document()->url() != m_url) {
+        return;
+    }
+    const auto cursor = m_view->cursorPosition();
+    if (cursor.line() != m_range.start().line() || cursor < m_range.start()) {
+        return;
+    }
+
+    auto completion = qobject_cast<KTextEditor::CodeCompletionInterface*>(m_view);
+    if (!completion) {
+        return;
+    }
+    m_reissuing = true;
+    completion->startCompletion({m_range.start(), cursor}, this);
+    m_reissuing = false;
 }
 
 #include "model.moc"
@@ -22,9 +22,16 @@
 #ifndef CLANGCODECOMPLETIONMODEL_H
 #define CLANGCODECOMPLETIONMODEL_H
 
+#include "duchain/unsavedfile.h"
+
 #include <language/codecompletion/codecompletionmodel.h>
 
+#include <KTextEditor/Range>
+
 #include <QMetaType>
+#include <QPointer>
+
+#include <functional>
 
 #include <ktexteditor_version.h>
 #if KTEXTEDITOR_VERSION < QT_VERSION_CHECK(5, 10, 0)
@@ -33,6 +40,12 @@ Q_DECLARE_METATYPE(KTextEditor::Cursor)
 
 class ClangIndex;
 
+namespace KDevelop {
+class IndexedString;
+class ReferencedTopDUContext;
+class ParseJob;
+}
+
 class ClangCodeCompletionModel : public KDevelop::CodeCompletionModel
 {
     Q_OBJECT
@@ -41,8 +54,23 @@ public:
     explicit ClangCodeCompletionModel(ClangIndex* index, QObject* parent);
     virtual ~ClangCodeCompletionModel();
 
+    using UnsavedFilesProvider = std::function<QVector<UnsavedFile>()>;
+    /**
+     * Set the function which returns the unsaved contents of all open documents, it is called on the GUI thread
+     * when a translation unit has to be parsed again before completing in it, see ParseSession::ensureCompletable()
+     */
+    void setUnsavedFilesProvider(const UnsavedFilesProvider& provider);
+
 signals:
-    void requestCompletion(const QUrl &url, const KTextEditor::Cursor& cursor, const QString& text, const QString& followingText);
+    /**
+     * @param text The text of the line before the cursor
+     * @param prefix The part of the identifier at the cursor typed so far
+     * @param contents The UTF-8 encoded contents of the document
+     * @param unsavedFiles The unsaved documents, only passed when the worker asked for them
+     */
+    void requestCompletion(const QUrl &url, const KTextEditor::Cursor& cursor, const QString& text,
+                           const QString& prefix, const QByteArray& contents,
+                           const QVector<UnsavedFile>& unsavedFiles);
 
 protected:
     KDevelop::CodeCompletionWorker* createCompletionWorker() override;
@@ -50,8 +78,45 @@ protected:
     void completionInvokedInternal(KTextEditor::View* view, const KTextEditor::Range& range,
                                    InvocationType invocationType, const QUrl &url) override;
 
+private slots:
+    /**
+     * Schedule an urgent reparse of @p url, as no AST was available to complete in it
+     */
+    void completionMissed(const QUrl& url);
+
+    /**
+     * Re-issue the last completion request with the unsaved documents, as the translation unit of @p url
+     * has to be parsed again first
+     */
+    void unsavedFilesRequired(const QUrl& url);
+
+    /**
+     * Called by the background parser once the urgent reparse landed, re-issues the completion
+     */
+    void updateReady(const KDevelop::IndexedString& url, const KDevelop::ReferencedTopDUContext& topContext);
+
+    /**
+     * Forget the urgent reparse when its job got aborted, so that the next completion miss retries it
+     */
+    void parseJobFinished(KDevelop::ParseJob* job);
+
 private:
     ClangIndex* m_index;
+    UnsavedFilesProvider m_unsavedFilesProvider;
+
+    /// The last completion request, re-issued after a completion miss
+    QPointer<KTextEditor::View> m_view;
+    KTextEditor::Range m_range;
+    QUrl m_url;
+    QString m_text;
+    QString m_prefix;
+    QByteArray m_contents;
+    /// The document for which an urgent reparse is pending
+    QUrl m_reparsedUrl;
+    /// True while re-issuing a completion request after a reparse
+    bool m_reissuing = false;
+    /// True when the last completion request was re-issued after a reparse, it is not retried again
+    bool m_reissued = false;
 };
 
 #endif // CLANGCODECOMPLETIONMODEL_H
@@ -180,7 +180,8 @@ QUrl findCompanionFile(const QUrl &fileUrl, const KTextEditor::Cursor& sc, const
         }
 
         const ParseSession altSession(getSession(potentialUrl));
-            if (!altSession.data()) {
+        // skip evicted translation units, see ClangSignatureAssistant::textChanged
+        if (!altSession.unit()) {
             continue;
         }
 
@@ -327,7 +328,9 @@ void ClangSignatureAssistant::textChanged(KTextEditor::View* view, const KTextEd
 
     QUrl fileUrl = m_view.data()->document()->url();
     const ParseSession session(getSession(fileUrl));
-    if (!session.data()) {
+    // evicted translation units are only parsed again by parse jobs, not on the GUI thread,
+    // the reparse scheduled for this edit restores it in time for the next one
+    if (!session.unit()) {
         return;
     }
 
@@ -437,7 +440,7 @@ void ClangSignatureAssistant::parseJobFinished(ParseJob* job)
 
     // TODO: there should be only one session
     const ParseSession sourceSession(getSession(m_view.data()->document()->url()));
-    if (!sourceSession.data()) {
+    if (!sourceSession.unit()) {
         reset();
         return;
     }
@@ -445,7 +448,7 @@ void ClangSignatureAssistant::parseJobFinished(ParseJob* job)
     CXTranslationUnit targetUnit = nullptr;
     if (!m_targetUnit.isEmpty()) {
         targetSession.setData(getSession(m_targetUnit));
-        if (!targetSession.data()) {
+        if (!targetSession.unit()) {
             reset();
             return;
         }
@@ -51,6 +51,8 @@
 
 #include <clang-c/Documentation.h>
 
+#include <QElapsedTimer>
+
 #include <unordered_map>
 #include <typeinfo>
 
@@ -265,11 +267,21 @@ struct CurrentContext
 };
 //END CurrentContext
 
+//BEGIN ResolvedUse
+/// A use whose declaration and range got resolved, but which is not yet part of the DUChain
+struct ResolvedUse
+{
+    DeclarationPointer used;
+    RangeInRevision range;
+};
+//END ResolvedUse
+
 //BEGIN Visitor
 struct Visitor
 {
-    explicit Visitor(CXTranslationUnit tu, CXFile file,
-                     const IncludeFileContexts& includes, const bool update);
+    explicit Visitor(CXTranslationUnit tu, CXFile file, const QVector<CXCursor>& cursors,
+                     const IncludeFileContexts& includes, const bool update,
+                     Builder::Statistics* statistics);
 
     AbstractType *makeType(CXType type, CXCursor parent);
     AbstractType::Ptr makeAbsType(CXType type, CXCursor parent)
@@ -750,6 +762,14 @@ struct Visitor
     DeclarationPointer findDeclaration(CXCursor cursor) const;
     void setIdTypeDecl(CXCursor typeCursor, IdentifiedType* idType) const;
 
+    /**
+     * Resolve the use @p cursors collected for @p context to the used declarations and use ranges.
+     *
+     * This only takes DUChain read locks and does not modify the visitor,
+     * so it may run concurrently with other readers of the DUChain.
+     */
+    QVector<ResolvedUse> resolveUses(DUContext* context, const std::vector<CXCursor>& cursors) const;
+
     std::unordered_map<DUContext*, std::vector<CXCursor>> m_uses;
     /// At these location offsets (cf. @ref clang_getExpansionLocation) we encountered macro expansions
     QSet<unsigned int> m_macroExpansionLocations;
@@ -757,6 +777,7 @@ struct Visitor
     CurrentContext *m_parentContext;
 
     const bool m_update;
+    Builder::Statistics* const m_statistics;
 };
 
 //BEGIN setTypeModifiers
@@ -1215,48 +1236,111 @@ RangeInRevision rangeInRevisionForUse(CXCursor cursor, CXCursorKind referencedCu
     return range;
 }
 
-Visitor::Visitor(CXTranslationUnit tu, CXFile file,
-                 const IncludeFileContexts& includes, const bool update)
+Visitor::Visitor(CXTranslationUnit tu, CXFile file, const QVector<CXCursor>& cursors,
+                 const IncludeFileContexts& includes, const bool update,
+                 Builder::Statistics* statistics)
     : m_file(file)
     , m_includes(includes)
     , m_parentContext(nullptr)
     , m_update(update)
+    , m_statistics(statistics)
 {
+    QElapsedTimer timer;
+    if (m_statistics) {
+        timer.start();
+    }
+
     CXCursor tuCursor = clang_getTranslationUnitCursor(tu);
     CurrentContext parent(includes[file]);
     m_parentContext = &parent;
-    clang_visitChildren(tuCursor, &visitCursor, this);
+    // equivalent to clang_visitChildren(tuCursor, ...), but restricted to the cursors of our file
+    for (const auto& cursor : cursors) {
+        const auto result = visitCursor(cursor, tuCursor, this);
+        if (result == CXChildVisit_Recurse) {
+            clang_visitChildren(cursor, &visitCursor, this);
+        } else if (result == CXChildVisit_Break) {
+            break;
+        }
+    }
 
     TopDUContext *top = m_parentContext->context->topContext();
+
+    if (m_statistics) {
+        m_statistics->declarationsTime += timer.nsecsElapsed();
+        timer.restart();
+    }
+
+    // resolve the uses without holding the DUChain write lock, then commit them in one batch per context
+    std::vector<std::pair<DUContext*, QVector<ResolvedUse>>> resolvedUses;
+    resolvedUses.reserve(m_uses.size());
+    for (const auto &contextUses : m_uses) {
+        resolvedUses.emplace_back(contextUses.first, resolveUses(contextUses.first, contextUses.second));
+    }
+
     if (m_update) {
         DUChainWriteLocker lock;
         top->deleteUsesRecursively();
     }
-    for (const auto &contextUses : m_uses) {
-        for (const auto &cursor : contextUses.second) {
-            auto referenced = referencedCursor(cursor);
-            if (clang_Cursor_isNull(referenced)) {
-                continue;
-            }
+    for (const auto &contextUses : resolvedUses) {
+        if (contextUses.second.isEmpty()) {
+            continue;
+        }
+        DUChainWriteLocker lock;
+        for (const auto &use : contextUses.second) {
+            auto usedIndex = top->indexForUsedDeclaration(use.used.data());
+            contextUses.first->createUse(usedIndex, use.range);
+        }
+        if (m_statistics) {
+            m_statistics->uses += contextUses.second.size();
+        }
+    }
 
-            auto used = findDeclaration(referenced);
-            if (!used) {
-                DUChainReadLocker lock;
-                DeclarationPointer decl = ClangHelpers::findForwardDeclaration(clang_getCursorType(referenced), contextUses.first, referenced);
-                used = decl;
-                if (!used) {
-                    continue;
-                }
-            }
+    if (m_statistics) {
+        m_statistics->usesTime += timer.nsecsElapsed();
+    }
+}
+
+QVector<ResolvedUse> Visitor::resolveUses(DUContext* context, const std::vector<CXCursor>& cursors) const
+{
+    QVector<ResolvedUse> resolved;
+    resolved.reserve(cursors.size());
+
+    // local cache on top of m_cursorToDeclarationCache, which must not be modified here
+    QHash<unsigned int, DeclarationPointer> declarationCache;
+    auto findUsedDeclaration = [&] (CXCursor referenced) -> DeclarationPointer {
+        const auto cursorHash = clang_hashCursor(referenced);
+        auto it = m_cursorToDeclarationCache.constFind(cursorHash);
+        if (it != m_cursorToDeclarationCache.constEnd()) {
+            return *it;
+        }
+        it = declarationCache.constFind(cursorHash);
+        if (it != declarationCache.constEnd()) {
+            return *it;
+        }
+        auto decl = ClangHelpers::findDeclaration(referenced, m_includes);
+        declarationCache.insert(cursorHash, decl);
+        return decl;
+    };
 
-            const auto useRange = clang_getCursorReferenceNameRange(cursor, 0, 0);
-            const auto range = rangeInRevisionForUse(cursor, referenced.kind, useRange, m_macroExpansionLocations);
+    for (const auto &cursor : cursors) {
+        auto referenced = referencedCursor(cursor);
+        if (clang_Cursor_isNull(referenced)) {
+            continue;
+        }
 
-            DUChainWriteLocker lock;
-            auto usedIndex = top->indexForUsedDeclaration(used.data());
-            contextUses.first->createUse(usedIndex, range);
+        auto used = findUsedDeclaration(referenced);
+        if (!used) {
+            DUChainReadLocker lock;
+            used = ClangHelpers::findForwardDeclaration(clang_getCursorType(referenced), context, referenced);
+            if (!used) {
+                continue;
+            }
         }
+
+        const auto useRange = clang_getCursorReferenceNameRange(cursor, 0, 0);
+        resolved.append({used, rangeInRevisionForUse(cursor, referenced.kind, useRange, m_macroExpansionLocations)});
     }
+    return resolved;
 }
 
 //END Visitor
@@ -1276,6 +1360,10 @@ CXChildVisitResult visitCursor(CXCursor cursor, CXCursor parent, CXClientData da
         return CXChildVisit_Continue;
     }
 
+    if (visitor->m_statistics) {
+        ++visitor->m_statistics->cursors;
+    }
+
 #define UseCursorKind(CursorKind, ...) case CursorKind: return visitor->dispatchCursor<CursorKind>(__VA_ARGS__);
     switch (kind)
     {
@@ -1341,9 +1429,31 @@ CXChildVisitResult visitCursor(CXCursor cursor, CXCursor parent, CXClientData da
 
 namespace Builder {
 
+FileCursors partitionCursors(CXTranslationUnit tu)
+{
+    FileCursors cursors;
+    clang_visitChildren(clang_getTranslationUnitCursor(tu), [] (CXCursor cursor, CXCursor /*parent*/, CXClientData data) -> CXChildVisitResult {
+        CXFile file;
+        clang_getFileLocation(clang_getCursorLocation(cursor), &file, nullptr, nullptr, nullptr);
+        if (file) {
+            // all locations of a TU share the CXFile of their file, i.e. the FileEntry of clang's FileManager,
+            // which is also what the imports and the IncludeFileContexts of the TU are keyed by
+            (*static_cast<FileCursors*>(data))[file].append(cursor);
+        }
+        return CXChildVisit_Continue;
+    }, &cursors);
+    return cursors;
+}
+
 void visit(CXTranslationUnit tu, CXFile file, const IncludeFileContexts& includes, const bool update)
 {
-    Visitor visitor(tu, file, includes, update);
+    visit(tu, file, partitionCursors(tu).value(file), includes, update);
+}
+
+void visit(CXTranslationUnit tu, CXFile file, const QVector<CXCursor>& cursors,
+           const IncludeFileContexts& includes, const bool update, Statistics* statistics)
+{
+    Visitor visitor(tu, file, cursors, includes, update, statistics);
 }
 
 void enableJSONTestRun()
@@ -27,18 +27,62 @@
 
 #include "clanghelpers.h"
 
+#include <QVector>
+
 namespace Builder {
 // TODO: Uh oh, this isn't nice. Can we make this better?
 KDEVCLANGDUCHAIN_EXPORT void enableJSONTestRun();
 
+/// The top-level cursors of a translation unit, grouped by the file they are located in
+using FileCursors = QHash<CXFile, QVector<CXCursor>>;
+
+/// Work done by a single @ref visit, used for benchmarking
+struct Statistics
+{
+    /// Number of visited cursors located in the built file
+    qint64 cursors = 0;
+    /// Number of uses created
+    qint64 uses = 0;
+    /// Nanoseconds spent visiting the cursors, i.e. creating declarations and contexts
+    qint64 declarationsTime = 0;
+    /// Nanoseconds spent resolving and creating the uses
+    qint64 usesTime = 0;
+};
+
+/**
+ * Walk the top-level cursors of @p tu once and group them by the file they belong to.
+ *
+ * Passing the result to @ref visit for every file of the include graph makes the
+ * DUChain build time scale with the size of the AST instead of the AST size times
+ * the number of included files.
+ *
+ * The files are keyed by their CXFile pointer, like in IncludeFileContexts. Within a single
+ * translation unit libclang hands out one CXFile per file, so this matches ClangUtils::isFileEqual.
+ */
+KDEVCLANGDUCHAIN_EXPORT FileCursors partitionCursors(CXTranslationUnit tu);
+
 /**
  * Visit the AST in @p tu and build declarations for cursors belonging to @p file.
- * 
+ *
+ * @note This walks all top-level cursors of @p tu, prefer the overload taking the
+ *       partitioned cursors when building more than one file of the same TU.
+ *
  * @param update Set to true when an existing DUChain cache is getting updated.
  */
 KDEVCLANGDUCHAIN_EXPORT void visit(CXTranslationUnit tu, CXFile file,
                                    const IncludeFileContexts& includes, const bool update);
 
+/**
+ * Build declarations for @p file by visiting its top-level @p cursors and their children.
+ *
+ * @param cursors The top-level cursors of @p file, cf. @ref partitionCursors
+ * @param update Set to true when an existing DUChain cache is getting updated.
+ * @param statistics When set, the work done is added to it.
+ */
+KDEVCLANGDUCHAIN_EXPORT void visit(CXTranslationUnit tu, CXFile file, const QVector<CXCursor>& cursors,
+                                   const IncludeFileContexts& includes, const bool update,
+                                   Statistics* statistics = nullptr);
+
 }
 
 #endif //BUILDER_H
@@ -35,7 +35,13 @@
 
 #include "util/clangtypes.h"
 
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSet>
+
 #include <algorithm>
+#include <memory>
+#include <vector>
 
 using namespace KDevelop;
 
@@ -91,42 +97,42 @@ ReferencedTopDUContext createTopContext(const IndexedString& path, const ClangPa
     return context;
 }
 
-}
-
-Imports ClangHelpers::tuImports(CXTranslationUnit tu)
-{
-    Imports imports;
-    // TODO: Use it once clang_getInclusions _does_ returns imports on reparse with CXTranslationUnit_PrecompiledPreamble flag.
-    //clang_getInclusions(tu, &::visitInclusions, &imports);
-
-    CXCursor tuCursor = clang_getTranslationUnitCursor(tu);
-    clang_visitChildren(tuCursor, &visitCursor, &imports);
-
-    return imports;
-}
-
-ReferencedTopDUContext ClangHelpers::buildDUChain(CXFile file, const Imports& imports, const ParseSession& session,
-                                                  TopDUContext::Features features, IncludeFileContexts& includedFiles,
-                                                  ClangIndex* index)
+/**
+ * Find or create the top context for @p file and update its imports and problems.
+ *
+ * The resulting context is inserted into @p includedFiles.
+ *
+ * An existing context is kept as-is when its file was only touched on disk, i.e. when the fingerprint
+ * of the content that got parsed is unchanged, and none of its imports got rebuilt. Rebuilt files are
+ * added to @p updatedFiles.
+ *
+ * @param update Set to true when an existing context got found.
+ * @return true when the declarations of @p file need to be (re)built.
+ */
+bool prepareContext(CXFile file, const IndexedString& path, const Imports& imports, const ParseSession& session,
+                    TopDUContext::Features features, IncludeFileContexts& includedFiles,
+                    ClangIndex* index, QSet<CXFile>& updatedFiles, bool* update)
 {
-    if (includedFiles.contains(file)) {
-        return {};
-    }
-
-    // prevent recursion
-    includedFiles.insert(file, {});
+    const auto& environment = session.environment();
 
-    // ensure DUChain for imports are build properly
-    foreach(const auto& import, imports.values(file)) {
-        buildDUChain(import.file, imports, session, features, includedFiles, index);
+    // fingerprint what got parsed before locking the DUChain, but only for files which may get updated
+    quint64 contentHash = 0;
+    if (!session.hasUnsavedContents(path)) {
+        bool needsUpdate = true;
+        {
+            DUChainReadLocker lock;
+            if (auto context = DUChain::self()->chainForDocument(path, &environment)) {
+                auto envFile = dynamic_cast<ClangParsingEnvironmentFile*>(context->parsingEnvironmentFile().data());
+                needsUpdate = !envFile || envFile->needsUpdate(&environment) || !envFile->featuresSatisfied(features);
+            }
+        }
+        if (needsUpdate) {
+            contentHash = session.contentHash(file);
+        }
     }
 
-    const IndexedString path(QDir::cleanPath(ClangString(clang_getFileName(file)).toString()));
-
-    const auto& environment = session.environment();
-
-    bool update = false;
-    UrlParseLock urlLock(path);
+    *update = false;
+    bool unchanged = false;
     ReferencedTopDUContext context;
     {
         DUChainWriteLocker lock;
@@ -134,27 +140,42 @@ ReferencedTopDUContext ClangHelpers::buildDUChain(CXFile file, const Imports& im
         if (!context) {
             context = ::createTopContext(path, environment);
         } else {
-            update = true;
+            *update = true;
         }
 
         includedFiles.insert(file, context);
-        if (update) {
-            auto envFile = ClangParsingEnvironmentFile::Ptr(dynamic_cast<ClangParsingEnvironmentFile*>(context->parsingEnvironmentFile().data()));
-            Q_ASSERT(envFile);
+        auto envFile = ClangParsingEnvironmentFile::Ptr(dynamic_cast<ClangParsingEnvironmentFile*>(context->parsingEnvironmentFile().data()));
+        Q_ASSERT(envFile);
+        if (*update) {
             if (!envFile->needsUpdate(&environment) && envFile->featuresSatisfied(features)) {
-                return context;
+                return false;
+            }
+
+            bool importsUpdated = false;
+            foreach(const auto& import, imports.values(file)) {
+                importsUpdated = importsUpdated || updatedFiles.contains(import.file);
+            }
+            if (!importsUpdated && envFile->featuresSatisfied(features) && !session.hasUnsavedContents(path)
+                && envFile->isContentUnchanged(&environment, contentHash))
+            {
+                // the file was only touched, keep its declarations and just refresh the revisions below
+                unchanged = true;
             } else {
                 //TODO: don't attempt to update if this environment is worse quality than the outdated one
                 if (index && envFile->environmentQuality() < environment.quality()) {
                     index->pinTranslationUnitForUrl(environment.translationUnitUrl(), path);
                 }
                 envFile->setEnvironment(environment);
-                envFile->setModificationRevision(ModificationRevision::revisionForFile(context->url()));
             }
+            envFile->setModificationRevision(ModificationRevision::revisionForFile(context->url()));
 
             context->clearImportedParentContexts();
         }
-        context->setFeatures(features);
+        if (!unchanged) {
+            // unknown for files parsed from their unsaved contents
+            envFile->setContentHash(contentHash);
+            context->setFeatures(features);
+        }
 
         foreach(const auto& import, imports.values(file)) {
             Q_ASSERT(includedFiles.contains(import.file));
@@ -168,17 +189,213 @@ ReferencedTopDUContext ClangHelpers::buildDUChain(CXFile file, const Imports& im
         context->updateImportsCache();
     }
 
+    if (unchanged) {
+        return false;
+    }
+    updatedFiles.insert(file);
+
     const auto problems = session.problemsForFile(file);
     {
         DUChainWriteLocker lock;
         context->setProblems(problems);
     }
+    return true;
+}
 
-    Builder::visit(session.unit(), file, includedFiles, update);
+IndexedString pathForFile(CXFile file)
+{
+    return IndexedString(QDir::cleanPath(ClangString(clang_getFileName(file)).toString()));
+}
+
+ReferencedTopDUContext buildDUChain(CXFile file, const Imports& imports, const ParseSession& session,
+                                    TopDUContext::Features features, IncludeFileContexts& includedFiles,
+                                    ClangIndex* index, const Builder::FileCursors& cursors, QSet<CXFile>& updatedFiles,
+                                    const std::function<bool()>& abortRequested)
+{
+    if (includedFiles.contains(file)) {
+        return {};
+    }
+
+    // prevent recursion
+    includedFiles.insert(file, {});
+
+    // ensure DUChain for imports are build properly
+    foreach(const auto& import, imports.values(file)) {
+        buildDUChain(import.file, imports, session, features, includedFiles, index, cursors, updatedFiles, abortRequested);
+    }
+
+    if (abortRequested && abortRequested()) {
+        // the imports are complete, so leaving this file untouched keeps the DUChain consistent
+        return {};
+    }
+
+    const auto path = pathForFile(file);
+
+    bool update = false;
+    UrlParseLock urlLock(path);
+    if (prepareContext(file, path, imports, session, features, includedFiles, index, updatedFiles, &update)) {
+        Builder::visit(session.unit(), file, cursors.value(file), includedFiles, update);
+    }
+
+    return includedFiles.value(file);
+}
+
+/**
+ * Assign each file reachable from @p file to a wave, such that all non-cyclic imports
+ * of a file are part of an earlier wave. Files already contained in @p includedFiles are skipped.
+ *
+ * @param order Receives the visited files in depth-first post-order, i.e. the serial build order
+ * @return the wave of @p file, or -1 if it is skipped or currently being visited (cyclic import)
+ */
+int planWaves(CXFile file, const Imports& imports, const IncludeFileContexts& includedFiles,
+              QHash<CXFile, int>& waves, QVector<CXFile>& order)
+{
+    if (includedFiles.contains(file)) {
+        return -1;
+    }
+    auto it = waves.constFind(file);
+    if (it != waves.constEnd()) {
+        return *it;
+    }
+
+    // prevent recursion
+    waves.insert(file, -1);
+
+    int wave = 0;
+    foreach(const auto& import, imports.values(file)) {
+        wave = std::max(wave, planWaves(import.file, imports, includedFiles, waves, order) + 1);
+    }
+
+    waves.insert(file, wave);
+    order.append(file);
+    return wave;
+}
+
+class VisitRunnable : public QRunnable
+{
+public:
+    VisitRunnable(CXTranslationUnit tu, CXFile file, const QVector<CXCursor>& cursors,
+                  const IncludeFileContexts& includes, bool update)
+        : m_tu(tu)
+        , m_file(file)
+        , m_cursors(cursors)
+        , m_includes(includes)
+        , m_update(update)
+    {
+    }
+
+    void run() override
+    {
+        Builder::visit(m_tu, m_file, m_cursors, m_includes, m_update);
+    }
+
+private:
+    CXTranslationUnit m_tu;
+    CXFile m_file;
+    QVector<CXCursor> m_cursors;
+    const IncludeFileContexts& m_includes;
+    bool m_update;
+};
+
+/**
+ * Like buildDUChain, but builds the declarations of all files in the same wave concurrently.
+ *
+ * All top contexts are prepared upfront on the calling thread, such that @p includedFiles
+ * is not modified anymore while the visitors are running.
+ */
+ReferencedTopDUContext buildDUChainParallel(CXFile file, const Imports& imports, const ParseSession& session,
+                                            TopDUContext::Features features, IncludeFileContexts& includedFiles,
+                                            ClangIndex* index, const Builder::FileCursors& cursors, int maxThreads,
+                                            const std::function<bool()>& abortRequested)
+{
+    QHash<CXFile, int> waves;
+    QVector<CXFile> order;
+    if (planWaves(file, imports, includedFiles, waves, order) == -1) {
+        return {};
+    }
+
+    QHash<CXFile, IndexedString> paths;
+    paths.reserve(order.size());
+    foreach (CXFile orderedFile, order) {
+        includedFiles.insert(orderedFile, {});
+        paths.insert(orderedFile, pathForFile(orderedFile));
+    }
+
+    // we keep all files locked until their declarations are built,
+    // always lock them in the same order to prevent dead locks with other parse jobs
+    auto sortedPaths = paths.values();
+    std::sort(sortedPaths.begin(), sortedPaths.end(), [] (const IndexedString& lhs, const IndexedString& rhs) {
+        return lhs.index() < rhs.index();
+    });
+    std::vector<std::unique_ptr<UrlParseLock>> urlLocks;
+    urlLocks.reserve(sortedPaths.size());
+    for (const auto& path : sortedPaths) {
+        urlLocks.emplace_back(new UrlParseLock(path));
+    }
+
+    struct PendingVisit
+    {
+        CXFile file;
+        bool update;
+    };
+    QVector<QVector<PendingVisit>> pendingWaves;
+    QSet<CXFile> updatedFiles;
+    foreach (CXFile orderedFile, order) {
+        if (abortRequested && abortRequested()) {
+            // files are ordered after their imports, so the prepared files can still be built consistently
+            break;
+        }
+        bool update = false;
+        if (prepareContext(orderedFile, paths.value(orderedFile), imports, session, features, includedFiles, index, updatedFiles, &update)) {
+            const int wave = waves.value(orderedFile);
+            if (pendingWaves.size() <= wave) {
+                pendingWaves.resize(wave + 1);
+            }
+            pendingWaves[wave].append({orderedFile, update});
+        }
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(maxThreads);
+    for (const auto& pendingVisits : pendingWaves) {
+        for (const auto& visit : pendingVisits) {
+            pool.start(new VisitRunnable(session.unit(), visit.file, cursors.value(visit.file), includedFiles, visit.update));
+        }
+        // the next wave depends on the declarations of this one
+        pool.waitForDone();
+    }
+
+    return includedFiles.value(file);
+}
 
-    return context;
 }
 
+Imports ClangHelpers::tuImports(CXTranslationUnit tu)
+{
+    Imports imports;
+    // TODO: Use it once clang_getInclusions _does_ returns imports on reparse with CXTranslationUnit_PrecompiledPreamble flag.
+    //clang_getInclusions(tu, &::visitInclusions, &imports);
+
+    CXCursor tuCursor = clang_getTranslationUnitCursor(tu);
+    clang_visitChildren(tuCursor, &visitCursor, &imports);
+
+    return imports;
+}
+
+ReferencedTopDUContext ClangHelpers::buildDUChain(CXFile file, const Imports& imports, const ParseSession& session,
+                                                  TopDUContext::Features features, IncludeFileContexts& includedFiles,
+                                                  ClangIndex* index, int maxThreads,
+                                                  const std::function<bool()>& abortRequested)
+{
+    const auto cursors = Builder::partitionCursors(session.unit());
+    if (maxThreads > 1) {
+        return ::buildDUChainParallel(file, imports, session, features, includedFiles, index, cursors, maxThreads, abortRequested);
+    }
+    QSet<CXFile> updatedFiles;
+    return ::buildDUChain(file, imports, session, features, includedFiles, index, cursors, updatedFiles, abortRequested);
+}
+
+
 DeclarationPointer ClangHelpers::findDeclaration(CXCursor cursor, const IncludeFileContexts& includes)
 {
     auto refLoc = clang_getCursorLocation(cursor);
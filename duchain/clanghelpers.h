@@ -28,6 +28,8 @@
 
 #include <duchain/clangduchainexport.h>
 
+#include <functional>
+
 class ParseSession;
 class ClangIndex;
 
@@ -67,12 +69,18 @@ KDEVCLANGDUCHAIN_EXPORT Imports tuImports(CXTranslationUnit tu);
  * Recursively builds a duchain with the specified @param features for the
  * @param file and each of its @param imports using the TU from @param session.
  * The resulting contexts are placed in @param includedFiles.
- * @returns the context created for @param file
+ *
+ * @param maxThreads When larger than one, the declarations of files whose imports
+ *        are already built are created concurrently on up to this many threads.
+ * @param abortRequested When set and returning true, no further files are built. Files
+ *        that were started are still completed, such that the DUChain stays consistent.
+ * @returns the context created for @param file, or a null context when aborted
  */
 KDEVCLANGDUCHAIN_EXPORT KDevelop::ReferencedTopDUContext buildDUChain(
     CXFile file, const Imports& imports, const ParseSession& session,
     KDevelop::TopDUContext::Features features, IncludeFileContexts& includedFiles,
-    ClangIndex* index = nullptr);
+    ClangIndex* index = nullptr, int maxThreads = 1,
+    const std::function<bool()>& abortRequested = {});
 
 /**
  * @return List of possible header extensions used for definition/declaration fallback switching
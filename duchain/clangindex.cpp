@@ -23,6 +23,7 @@
 
 #include "clangpch.h"
 #include "clangparsingenvironment.h"
+#include "parsesession.h"
 #include "documentfinderhelpers.h"
 
 #include <util/path.h>
@@ -32,11 +33,148 @@
 
 #include <clang-c/Index.h>
 
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSet>
+#include <QTemporaryFile>
+#include <QTextStream>
+
+#include <algorithm>
+#include <functional>
+
 using namespace KDevelop;
 
+/**
+ * Watches the directories of the files for which translationUnitForUrl results are cached.
+ *
+ * Lives in the thread that created the ClangIndex, directories can be added from any thread.
+ */
+class ClangIndexWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ClangIndexWatcher(const std::function<void(const QString&)>& invalidate)
+    {
+        connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, [invalidate] (const QString& directory) {
+            invalidate(directory);
+        });
+    }
+
+    /// This function is thread safe.
+    void watch(const QString& directory)
+    {
+        QMetaObject::invokeMethod(this, "addDirectory", Qt::QueuedConnection, Q_ARG(QString, directory));
+    }
+
+    /// Stop watching all directories. This function is thread safe.
+    void clear()
+    {
+        QMetaObject::invokeMethod(this, "removeDirectories", Qt::QueuedConnection);
+    }
+
+private:
+    Q_INVOKABLE void addDirectory(const QString& directory)
+    {
+        if (!m_directories.contains(directory) && QFileInfo(directory).isDir()) {
+            m_directories.insert(directory);
+            m_watcher.addPath(directory);
+        }
+    }
+
+    Q_INVOKABLE void removeDirectories()
+    {
+        if (!m_directories.isEmpty()) {
+            m_watcher.removePaths(m_directories.toList());
+            m_directories.clear();
+        }
+    }
+
+    QFileSystemWatcher m_watcher;
+    QSet<QString> m_directories;
+};
+
+namespace {
+
+/// a shared PCH is only created for include prefixes used by at least this many translation units
+const int MinimumSharedPchUsers = 3;
+
+/// @returns the hash of @p environment, ignoring the PCH include
+uint prefixEnvironmentHash(const ClangParsingEnvironment& environment)
+{
+    auto withoutPch = environment;
+    withoutPch.setPchInclude({});
+    return withoutPch.hash();
+}
+
+/**
+ * @returns the longest prefix of @p includes that is shared
+ * by at least MinimumSharedPchUsers - 1 of the @p others
+ */
+Path::List sharedPrefix(const IndexedString& tuUrl, const Path::List& includes,
+                        const QHash<IndexedString, Path::List>& others)
+{
+    QVector<int> lengths;
+    for (auto it = others.constBegin(); it != others.constEnd(); ++it) {
+        if (it.key() == tuUrl) {
+            continue;
+        }
+        const auto& other = it.value();
+        const int maxLength = std::min(includes.size(), other.size());
+        int length = 0;
+        while (length < maxLength && includes.at(length) == other.at(length)) {
+            ++length;
+        }
+        if (length) {
+            lengths.append(length);
+        }
+    }
+
+    const int otherUsers = MinimumSharedPchUsers - 1;
+    if (lengths.size() < otherUsers) {
+        return {};
+    }
+    std::nth_element(lengths.begin(), lengths.begin() + otherUsers - 1, lengths.end(), std::greater<int>());
+    return includes.mid(0, lengths.at(otherUsers - 1));
+}
+
+/**
+ * @returns the environment to parse the PCH include of @p environment in
+ *
+ * Synthesized headers of shared include prefixes need the includes and defines of the translation units
+ * using them, user defined PCH includes are parsed on their own, as they are shared between all targets.
+ */
+ClangParsingEnvironment pchEnvironment(const ClangParsingEnvironment& environment, const QString& pchDirectory)
+{
+    const auto& pchInclude = environment.pchInclude();
+    ClangParsingEnvironment pchEnv;
+    if (!pchDirectory.isEmpty() && Path(pchDirectory).isParentOf(pchInclude)) {
+        pchEnv = environment;
+    }
+    pchEnv.setPchInclude(Path());
+    pchEnv.setTranslationUnitUrl(IndexedString(pchInclude.pathOrUrl()));
+    return pchEnv;
+}
+
+QSharedPointer<const QTemporaryFile> writeDefinesFile(const QMap<QString, QString>& defines)
+{
+    auto file = QSharedPointer<QTemporaryFile>::create();
+    file->open();
+    Q_ASSERT(file->isWritable());
+    QTextStream definesStream(file.data());
+    for (auto it = defines.begin(); it != defines.end(); ++it) {
+        definesStream << QStringLiteral("#define ") << it.key() << ' ' << it.value() << '\n';
+    }
+    definesStream.flush();
+    return file;
+}
+
+}
+
 ClangIndex::ClangIndex()
     // NOTE: We don't exclude PCH declarations. That way we could retrieve imports manually, as clang_getInclusions returns nothing on reparse with CXTranslationUnit_PrecompiledPreamble flag.
     : m_index(clang_createIndex(0 /*Exclude PCH Decls*/, qgetenv("KDEV_CLANG_DISPLAY_DIAGS") == "1" /*Display diags*/))
+    , m_watcher(new ClangIndexWatcher([this] (const QString& directory) { invalidateTranslationUnitCache(directory); }))
 {
 }
 
@@ -56,59 +194,344 @@ QSharedPointer<const ClangPCH> ClangIndex::pch(const ClangParsingEnvironment& en
 
     static const QString pchExt = QStringLiteral(".pch");
 
+    const auto pchEnv = ::pchEnvironment(environment, m_pchDirectory);
+    const auto key = qMakePair(pchInclude, pchEnv.hash());
     if (QFile::exists(pchInclude.toLocalFile() + pchExt)) {
         QReadLocker lock(&m_pchLock);
-        auto pch = m_pch.constFind(pchInclude);
+        auto pch = m_pch.constFind(key);
         if (pch != m_pch.constEnd()) {
             return pch.value();
         }
     }
 
-    auto pch = QSharedPointer<ClangPCH>::create(environment, this);
+    auto pch = QSharedPointer<ClangPCH>::create(pchEnv, this);
     QWriteLocker lock(&m_pchLock);
-    m_pch.insert(pchInclude, pch);
+    m_pch.insert(key, pch);
     return pch;
 }
 
+QSharedPointer<const QTemporaryFile> ClangIndex::definesFile(const ClangParsingEnvironment& environment)
+{
+    const auto defines = environment.defines();
+    const auto hash = environment.definesHash();
+
+    QMutexLocker lock(&m_definesMutex);
+    auto it = m_definesFiles.constFind(hash);
+    if (it != m_definesFiles.constEnd()) {
+        if (auto file = it->file.toStrongRef()) {
+            if (it->defines == defines) {
+                return file;
+            }
+            // hash collision, don't share the file
+            return writeDefinesFile(defines);
+        }
+    }
+
+    // cleanup files that are not used anymore
+    for (auto it = m_definesFiles.begin(); it != m_definesFiles.end();) {
+        if (it->file.isNull()) {
+            it = m_definesFiles.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    auto file = writeDefinesFile(defines);
+    m_definesFiles.insert(hash, {defines, file});
+    return file;
+}
+
+void ClangIndex::setIncludePrefix(const ClangParsingEnvironment& environment, const Path::List& includes)
+{
+    QMutexLocker lock(&m_sharedPchMutex);
+    auto& prefixes = m_includePrefixes[prefixEnvironmentHash(environment)];
+    if (includes.isEmpty()) {
+        prefixes.remove(environment.translationUnitUrl());
+    } else {
+        prefixes.insert(environment.translationUnitUrl(), includes);
+    }
+}
+
+Path ClangIndex::sharedPchInclude(const ClangParsingEnvironment& environment)
+{
+    const auto tuUrl = environment.translationUnitUrl();
+    const auto environmentHash = prefixEnvironmentHash(environment);
+
+    QMutexLocker lock(&m_sharedPchMutex);
+    const auto& prefixes = m_includePrefixes.value(environmentHash);
+    const auto prefix = sharedPrefix(tuUrl, prefixes.value(tuUrl), prefixes);
+
+    Path header;
+    if (!prefix.isEmpty() && !m_pchDirectory.isEmpty()) {
+        KDevHash hash(environmentHash);
+        for (const auto& include : prefix) {
+            hash << qHash(include);
+        }
+        header = Path(m_pchDirectory + QStringLiteral("/prefix-%1.h").arg(static_cast<uint>(hash)));
+
+        QFile file(header.toLocalFile());
+        if (!file.exists() && file.open(QIODevice::WriteOnly)) {
+            QTextStream stream(&file);
+            for (const auto& include : prefix) {
+                stream << QStringLiteral("#include \"") << include.toLocalFile() << QStringLiteral("\"\n");
+            }
+        }
+    }
+
+    const auto oldHeader = m_sharedPchForTu.value(tuUrl);
+    if (header.isValid()) {
+        m_sharedPchForTu.insert(tuUrl, header);
+    } else {
+        m_sharedPchForTu.remove(tuUrl);
+    }
+
+    if (oldHeader.isValid() && oldHeader != header
+        && std::find(m_sharedPchForTu.constBegin(), m_sharedPchForTu.constEnd(), oldHeader) == m_sharedPchForTu.constEnd())
+    {
+        // the prefix is not used by any translation unit anymore, the header is kept as the DUChain references it
+        clangDebug() << "removing unused shared PCH" << oldHeader;
+        {
+            QWriteLocker pchLock(&m_pchLock);
+            for (auto it = m_pch.begin(); it != m_pch.end();) {
+                if (it.key().first == oldHeader) {
+                    it = m_pch.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        QFile::remove(oldHeader.toLocalFile() + QStringLiteral(".pch"));
+    }
+
+    return header;
+}
+
+void ClangIndex::setPchDirectory(const QString& directory)
+{
+    if (!directory.isEmpty() && !QDir().mkpath(directory)) {
+        qCWarning(KDEV_CLANG) << "failed to create PCH directory" << directory;
+        m_pchDirectory.clear();
+        return;
+    }
+    m_pchDirectory = directory;
+}
+
+QString ClangIndex::pchDirectory() const
+{
+    return m_pchDirectory;
+}
+
+void ClangIndex::setTranslationUnitMemoryBudget(quint64 budget)
+{
+    QVector<ParseSessionData*> evicted;
+    {
+        QMutexLocker lock(&m_sessionsMutex);
+        if (budget == m_memoryBudget) {
+            return;
+        }
+        m_memoryBudget = budget;
+        evicted = sessionsToEvict(nullptr);
+    }
+    evictSessions(evicted);
+}
+
+quint64 ClangIndex::translationUnitMemoryUsage()
+{
+    QMutexLocker lock(&m_sessionsMutex);
+    quint64 usage = 0;
+    for (const auto& sessionUsage : m_sessions) {
+        usage += sessionUsage.memoryUsage;
+    }
+    return usage;
+}
+
+void ClangIndex::updateSession(ParseSessionData* session, quint64 memoryUsage)
+{
+    QVector<ParseSessionData*> evicted;
+    {
+        QMutexLocker lock(&m_sessionsMutex);
+        auto it = std::find_if(m_sessions.begin(), m_sessions.end(), [session] (const SessionUsage& sessionUsage) {
+            return sessionUsage.session == session;
+        });
+        if (it != m_sessions.end()) {
+            m_sessions.erase(it);
+        }
+        m_sessions.append({session, memoryUsage});
+        evicted = sessionsToEvict(session);
+    }
+    evictSessions(evicted);
+}
+
+void ClangIndex::touchSession(ParseSessionData* session)
+{
+    QMutexLocker lock(&m_sessionsMutex);
+    auto it = std::find_if(m_sessions.begin(), m_sessions.end(), [session] (const SessionUsage& sessionUsage) {
+        return sessionUsage.session == session;
+    });
+    if (it != m_sessions.end() && it != m_sessions.end() - 1) {
+        const auto sessionUsage = *it;
+        m_sessions.erase(it);
+        m_sessions.append(sessionUsage);
+    }
+}
+
+void ClangIndex::unregisterSession(ParseSessionData* session)
+{
+    QMutexLocker lock(&m_sessionsMutex);
+    auto it = std::find_if(m_sessions.begin(), m_sessions.end(), [session] (const SessionUsage& sessionUsage) {
+        return sessionUsage.session == session;
+    });
+    if (it != m_sessions.end()) {
+        m_sessions.erase(it);
+    }
+}
+
+QVector<ParseSessionData*> ClangIndex::sessionsToEvict(ParseSessionData* current)
+{
+    QVector<ParseSessionData*> sessions;
+    if (!m_memoryBudget) {
+        return sessions;
+    }
+
+    quint64 usage = 0;
+    for (const auto& sessionUsage : m_sessions) {
+        usage += sessionUsage.memoryUsage;
+    }
+
+    for (auto it = m_sessions.begin(); usage > m_memoryBudget && it != m_sessions.end(); ++it) {
+        auto session = it->session;
+        // sessions that are in use right now are skipped, evicting them would block
+        if (session == current || !it->memoryUsage || !session->m_mutex.tryLock()) {
+            continue;
+        }
+        sessions.append(session);
+        // keep the session registered, it gets updated once parsed again
+        usage -= it->memoryUsage;
+        it->memoryUsage = 0;
+    }
+    return sessions;
+}
+
+void ClangIndex::evictSessions(const QVector<ParseSessionData*>& sessions)
+{
+    for (auto session : sessions) {
+        session->evict();
+        session->m_mutex.unlock();
+    }
+}
+
 ClangIndex::~ClangIndex()
 {
+    {
+        QMutexLocker lock(&m_sessionsMutex);
+        for (const auto& sessionUsage : m_sessions) {
+            sessionUsage.session->m_index = nullptr;
+        }
+    }
     clang_disposeIndex(m_index);
 }
 
 IndexedString ClangIndex::translationUnitForUrl(const IndexedString& url)
 {
-    { // try explicit pin data first
-        QMutexLocker lock(&m_mappingMutex);
-        auto tu = m_tuForUrl.find(url);
-        if (tu != m_tuForUrl.end()) {
-            if (!QFile::exists(tu.value().str())) {
-                // TU doesn't exist, unpin
-                m_tuForUrl.erase(tu);
-                return url;
-            }
-            return tu.value();
+    IndexedString pinnedTu;
+    quint64 revision = 0;
+    {
+        QReadLocker lock(&m_mappingLock);
+        auto tu = m_resolvedTuForUrl.constFind(url);
+        if (tu != m_resolvedTuForUrl.constEnd()) {
+            return tu->tu;
         }
+        pinnedTu = m_tuForUrl.value(url);
+        revision = m_mappingRevision;
     }
-    // otherwise, fallback to a simple buddy search for headers
-    if (ClangHelpers::isHeader(url.str())) {
+
+    // check the file system without holding the lock, other threads only wait for the insertion
+    IndexedString tuUrl = url;
+    QVector<QString> directories = {QFileInfo(url.str()).path()};
+    bool pinnedTuExists = true;
+    // try explicit pin data first
+    if (!pinnedTu.isEmpty()) {
+        pinnedTuExists = QFile::exists(pinnedTu.str());
+        if (pinnedTuExists) {
+            tuUrl = pinnedTu;
+            directories.append(QFileInfo(tuUrl.str()).path());
+        }
+    } else if (ClangHelpers::isHeader(url.str())) {
+        // otherwise, fallback to a simple buddy search for headers
         foreach(const QUrl& buddy, DocumentFinderHelpers::getPotentialBuddies(url.toUrl(), false)) {
             const QString buddyPath = buddy.toLocalFile();
+            directories.append(QFileInfo(buddyPath).path());
             if (QFile::exists(buddyPath)) {
-                return IndexedString(buddyPath);
+                tuUrl = IndexedString(buddyPath);
+                break;
             }
         }
     }
-    return url;
+    std::sort(directories.begin(), directories.end());
+    directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+
+    QWriteLocker lock(&m_mappingLock);
+    if (!pinnedTuExists) {
+        // TU doesn't exist, unpin, unless something else got pinned meanwhile
+        auto tu = m_tuForUrl.find(url);
+        if (tu != m_tuForUrl.end() && tu.value() == pinnedTu) {
+            m_tuForUrl.erase(tu);
+        }
+    }
+
+    // the result stays valid until a file gets added or removed in one of the directories,
+    // only directories in projects are watched, the results of other files are never cached
+    const bool inProjects = std::all_of(directories.constBegin(), directories.constEnd(), [this] (const QString& directory) {
+        const Path path(directory);
+        return std::any_of(m_projectPaths.constBegin(), m_projectPaths.constEnd(), [&path] (const Path& projectPath) {
+            return projectPath == path || projectPath.isParentOf(path);
+        });
+    });
+    if (revision == m_mappingRevision && inProjects) {
+        m_resolvedTuForUrl.insert(url, {tuUrl, directories});
+        foreach (const auto& directory, directories) {
+            m_watcher->watch(directory);
+        }
+    }
+    return tuUrl;
 }
 
 void ClangIndex::pinTranslationUnitForUrl(const IndexedString& tu, const IndexedString& url)
 {
-    QMutexLocker lock(&m_mappingMutex);
+    QWriteLocker lock(&m_mappingLock);
     m_tuForUrl.insert(url, tu);
+    m_resolvedTuForUrl.remove(url);
+    ++m_mappingRevision;
 }
 
 void ClangIndex::unpinTranslationUnitForUrl(const IndexedString& url)
 {
-    QMutexLocker lock(&m_mappingMutex);
+    QWriteLocker lock(&m_mappingLock);
     m_tuForUrl.remove(url);
+    m_resolvedTuForUrl.remove(url);
+    ++m_mappingRevision;
 }
+
+void ClangIndex::setProjectPaths(const Path::List& projectPaths)
+{
+    QWriteLocker lock(&m_mappingLock);
+    m_projectPaths = projectPaths;
+    m_resolvedTuForUrl.clear();
+    ++m_mappingRevision;
+    m_watcher->clear();
+}
+
+void ClangIndex::invalidateTranslationUnitCache(const QString& directory)
+{
+    QWriteLocker lock(&m_mappingLock);
+    for (auto it = m_resolvedTuForUrl.begin(); it != m_resolvedTuForUrl.end();) {
+        if (it->directories.contains(directory)) {
+            it = m_resolvedTuForUrl.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    ++m_mappingRevision;
+}
+
+#include "clangindex.moc"
@@ -29,13 +29,19 @@
 
 #include <util/path.h>
 
+#include <QMap>
 #include <QReadWriteLock>
+#include <QScopedPointer>
 #include <QSharedPointer>
 
 #include <clang-c/Index.h>
 
 class ClangParsingEnvironment;
 class ClangPCH;
+class ParseSessionData;
+class ClangIndexWatcher;
+
+class QTemporaryFile;
 
 class KDEVCLANGDUCHAIN_EXPORT ClangIndex
 {
@@ -52,13 +58,69 @@ public:
      */
     QSharedPointer<const ClangPCH> pch(const ClangParsingEnvironment& defines);
 
+    /**
+     * @returns a file containing the defines of @param environment, to be passed via -imacros
+     * The file is shared by all callers using the same defines and removed once the last reference is gone.
+     * This function is thread safe.
+     */
+    QSharedPointer<const QTemporaryFile> definesFile(const ClangParsingEnvironment& environment);
+
+    /**
+     * Remember the leading @p includes of the translation unit parsed in @p environment.
+     * They are used to find include prefixes shared between translation units, see sharedPchInclude().
+     * This function is thread safe.
+     */
+    void setIncludePrefix(const ClangParsingEnvironment& environment, const KDevelop::Path::List& includes);
+
+    /**
+     * @returns a synthesized header for the longest include prefix the translation unit of @param environment
+     * shares with other translation units of the same environment, or an invalid path if there is none,
+     * or if no PCH directory is set.
+     * The header is meant to be used as PCH include, see pch().
+     * The PCHs of prefixes that are not used anymore are removed, their headers are kept as
+     * the DUChain may still reference them.
+     * This function is thread safe.
+     */
+    KDevelop::Path sharedPchInclude(const ClangParsingEnvironment& environment);
+
+    /**
+     * Set the directory in which the headers of shared include prefixes and their PCHs are stored,
+     * see sharedPchInclude(). It should outlive the session, as the DUChain references the headers.
+     * An empty path disables shared PCHs. Must be set before parsing starts.
+     */
+    void setPchDirectory(const QString& directory);
+    QString pchDirectory() const;
+
+    /**
+     * Limit the memory used by the translation units of all parse sessions to @param budget bytes, 0 disables the limit.
+     * When exceeded, the translation units of the least recently used sessions are disposed.
+     * They get parsed again when the session is used the next time.
+     * This function is thread safe.
+     */
+    void setTranslationUnitMemoryBudget(quint64 budget);
+
+    /**
+     * @returns the memory used by the translation units of all parse sessions in bytes
+     * This function is thread safe.
+     */
+    quint64 translationUnitMemoryUsage();
+
     /**
      * Gets the currently pinned TU for @p url
      *
      * If the currently pinned TU does not import @p url, @p url is returned
+     * Results for files in projects are cached until a file is added to or removed from a related directory.
+     * This function is thread safe.
      */
     KDevelop::IndexedString translationUnitForUrl(const KDevelop::IndexedString& url);
 
+    /**
+     * Set the paths of the open projects, only directories below them are watched for the
+     * translationUnitForUrl cache. This drops the cache.
+     * This function is thread safe.
+     */
+    void setProjectPaths(const KDevelop::Path::List& projectPaths);
+
     /**
      * Pin @p tu as the translation unit to use when parsing @p url
      */
@@ -70,13 +132,67 @@ public:
     void unpinTranslationUnitForUrl(const KDevelop::IndexedString& url);
 
 private:
+    friend class ParseSessionData;
+
+    /// Register @p session or update its memory usage, and mark it as most recently used
+    void updateSession(ParseSessionData* session, quint64 memoryUsage);
+    /// Mark @p session as most recently used, if it is registered
+    void touchSession(ParseSessionData* session);
+    void unregisterSession(ParseSessionData* session);
+    /**
+     * Lock the least recently used sessions except @p current, until evicting them meets the budget.
+     * Requires m_sessionsMutex, the sessions are then passed to evictSessions() after unlocking it.
+     */
+    QVector<ParseSessionData*> sessionsToEvict(ParseSessionData* current);
+    /// Dispose the translation units of @p sessions and unlock them
+    static void evictSessions(const QVector<ParseSessionData*>& sessions);
+    /// Drop the cached translationUnitForUrl results which depend on @p directory
+    void invalidateTranslationUnitCache(const QString& directory);
+
     CXIndex m_index;
 
     QReadWriteLock m_pchLock;
-    QHash<KDevelop::Path, QSharedPointer<const ClangPCH>> m_pch;
-
-    QMutex m_mappingMutex;
+    /// PCHs by their include and the hash of the environment they got parsed in
+    QHash<QPair<KDevelop::Path, uint>, QSharedPointer<const ClangPCH>> m_pch;
+
+    struct DefinesFile
+    {
+        QMap<QString, QString> defines;
+        QWeakPointer<const QTemporaryFile> file;
+    };
+    QMutex m_definesMutex;
+    QHash<uint, DefinesFile> m_definesFiles;
+
+    QMutex m_sharedPchMutex;
+    QString m_pchDirectory;
+    /// leading includes per translation unit, grouped by environment hash
+    QHash<uint, QHash<KDevelop::IndexedString, KDevelop::Path::List>> m_includePrefixes;
+    QHash<KDevelop::IndexedString, KDevelop::Path> m_sharedPchForTu;
+
+    struct SessionUsage
+    {
+        ParseSessionData* session;
+        quint64 memoryUsage;
+    };
+    QMutex m_sessionsMutex;
+    /// registered sessions, the least recently used first
+    QVector<SessionUsage> m_sessions;
+    quint64 m_memoryBudget = 0;
+
+    QReadWriteLock m_mappingLock;
     QHash<KDevelop::IndexedString, KDevelop::IndexedString> m_tuForUrl;
+    struct ResolvedTu
+    {
+        KDevelop::IndexedString tu;
+        /// the directories whose contents determine the result
+        QVector<QString> directories;
+    };
+    /// cached results of translationUnitForUrl
+    QHash<KDevelop::IndexedString, ResolvedTu> m_resolvedTuForUrl;
+    /// incremented whenever cached results are dropped, results computed meanwhile are not cached
+    quint64 m_mappingRevision = 0;
+    KDevelop::Path::List m_projectPaths;
+    QScopedPointer<ClangIndexWatcher> m_watcher;
 };
 
 #endif //CLANGINDEX_H
@@ -23,6 +23,57 @@
 
 using namespace KDevelop;
 
+/**
+ * A trie of the segments of the project paths, to find out in one pass over the segments
+ * of a path whether it is inside any project.
+ */
+class ProjectPathTrie
+{
+public:
+    explicit ProjectPathTrie(const Path::List& projectPaths)
+        : m_nodes(1)
+    {
+        for (const auto& projectPath : projectPaths) {
+            int node = 0;
+            foreach (const auto& segment, projectPath.segments()) {
+                int child = m_nodes[node].children.value(segment, -1);
+                if (child == -1) {
+                    child = m_nodes.size();
+                    m_nodes[node].children.insert(segment, child);
+                    m_nodes.append({});
+                }
+                node = child;
+            }
+            m_nodes[node].isProjectPath = true;
+        }
+    }
+
+    /// @return true if @p path is a project path or inside of one
+    bool contains(const Path& path) const
+    {
+        int node = 0;
+        foreach (const auto& segment, path.segments()) {
+            node = m_nodes.at(node).children.value(segment, -1);
+            if (node == -1) {
+                return false;
+            }
+            if (m_nodes.at(node).isProjectPath) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Node
+    {
+        QHash<QString, int> children;
+        bool isProjectPath = false;
+    };
+    /// the root node is the first one
+    QVector<Node> m_nodes;
+};
+
 int ClangParsingEnvironment::type() const
 {
     return CppParsingEnvironment;
@@ -31,6 +82,14 @@ int ClangParsingEnvironment::type() const
 void ClangParsingEnvironment::setProjectPaths(const Path::List& projectPaths)
 {
     m_projectPaths = projectPaths;
+    m_projectPathTrie.reset(new ProjectPathTrie(projectPaths));
+
+    m_includePaths = {};
+    m_includePaths.project.reserve(m_includes.size());
+    m_includePaths.system.reserve(m_includes.size());
+    foreach (const auto& path, m_includes) {
+        (m_projectPathTrie->contains(path) ? m_includePaths.project : m_includePaths.system).append(path);
+    }
 }
 
 Path::List ClangParsingEnvironment::projectPaths() const
@@ -41,28 +100,16 @@ Path::List ClangParsingEnvironment::projectPaths() const
 void ClangParsingEnvironment::addIncludes(const Path::List& includes)
 {
     m_includes += includes;
+
+    foreach (const auto& path, includes) {
+        const bool inProject = m_projectPathTrie && m_projectPathTrie->contains(path);
+        (inProject ? m_includePaths.project : m_includePaths.system).append(path);
+    }
 }
 
-ClangParsingEnvironment::IncludePaths ClangParsingEnvironment::includes() const
+const ClangParsingEnvironment::IncludePaths& ClangParsingEnvironment::includes() const
 {
-    IncludePaths ret;
-    ret.project.reserve(m_includes.size());
-    ret.system.reserve(m_includes.size());
-    foreach (const auto& path, m_includes) {
-        bool inProject = false;
-        foreach (const auto& project, m_projectPaths) {
-            if (project.isParentOf(path) || project == path) {
-                inProject = true;
-                break;
-            }
-        }
-        if (inProject) {
-            ret.project.append(path);
-        } else {
-            ret.system.append(path);
-        }
-    }
-    return ret;
+    return m_includePaths;
 }
 
 void ClangParsingEnvironment::addDefines(const QHash<QString, QString>& defines)
@@ -80,6 +127,13 @@ QMap<QString, QString> ClangParsingEnvironment::defines() const
 void ClangParsingEnvironment::setPchInclude(const Path& path)
 {
     m_pchInclude = path;
+    m_sharedPchInclude = false;
+}
+
+void ClangParsingEnvironment::setSharedPchInclude(const Path& path)
+{
+    m_pchInclude = path;
+    m_sharedPchInclude = path.isValid();
 }
 
 Path ClangParsingEnvironment::pchInclude() const
@@ -121,11 +175,22 @@ uint ClangParsingEnvironment::hash() const
         hash << qHash(include);
     }
 
-    hash << qHash(m_pchInclude);
+    hash << qHash(m_sharedPchInclude ? Path() : m_pchInclude);
     hash << qHash(m_parserSettings.parserOptions);
     return hash;
 }
 
+uint ClangParsingEnvironment::definesHash() const
+{
+    KDevHash hash;
+    hash << m_defines.size();
+
+    for (auto it = m_defines.constBegin(); it != m_defines.constEnd(); ++it) {
+        hash << qHash(it.key()) << qHash(it.value());
+    }
+    return hash;
+}
+
 bool ClangParsingEnvironment::operator==(const ClangParsingEnvironment& other) const
 {
     return m_defines == other.m_defines
@@ -29,6 +29,10 @@
 
 #include "clangsettings/clangsettingsmanager.h"
 
+#include <QSharedPointer>
+
+class ProjectPathTrie;
+
 class KDEVCLANGDUCHAIN_EXPORT ClangParsingEnvironment : public KDevelop::ParsingEnvironment
 {
 public:
@@ -58,8 +62,10 @@ public:
     };
     /**
      * Returns the list of includes, split into a list of system includes and project includes.
+     *
+     * The split is updated whenever includes or project paths are set, not on every call.
      */
-    IncludePaths includes() const;
+    const IncludePaths& includes() const;
 
     void addDefines(const QHash<QString, QString>& defines);
     QMap<QString, QString> defines() const;
@@ -67,6 +73,13 @@ public:
     void setPchInclude(const KDevelop::Path& path);
     KDevelop::Path pchInclude() const;
 
+    /**
+     * Set the PCH include precompiled from the includes this translation unit has in common with others,
+     * see ClangIndex::sharedPchInclude(). Unlike a user defined one it does not change the contents of the
+     * translation unit, and depends on which files got parsed before, so it is not part of hash().
+     */
+    void setSharedPchInclude(const KDevelop::Path& path);
+
     void setTranslationUnitUrl(const KDevelop::IndexedString& url);
     KDevelop::IndexedString translationUnitUrl() const;
 
@@ -92,6 +105,11 @@ public:
      */
     uint hash() const;
 
+    /**
+     * Hash only the defines of this environment, see hash().
+     */
+    uint definesHash() const;
+
     bool operator==(const ClangParsingEnvironment& other) const;
     bool operator!=(const ClangParsingEnvironment& other) const
     {
@@ -101,9 +119,14 @@ public:
 private:
     KDevelop::Path::List m_projectPaths;
     KDevelop::Path::List m_includes;
+    /// m_includes split by the project paths
+    IncludePaths m_includePaths;
+    /// the segments of m_projectPaths, shared between copies of this environment
+    QSharedPointer<const ProjectPathTrie> m_projectPathTrie;
     // NOTE: As elements in QHash stored in an unordered sequence, we're using QMap instead
     QMap<QString, QString> m_defines;
     KDevelop::Path m_pchInclude;
+    bool m_sharedPchInclude = false;
     KDevelop::IndexedString m_tuUrl;
     Quality m_quality = Unknown;
     ParserSettings m_parserSettings;
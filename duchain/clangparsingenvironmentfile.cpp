@@ -29,6 +29,36 @@
 
 using namespace KDevelop;
 
+/**
+ * The data of ClangParsingEnvironmentFile before the content fingerprint was added,
+ * only kept to read the environment files of existing sessions.
+ */
+class LegacyClangParsingEnvironmentFileData : public ParsingEnvironmentFileData
+{
+public:
+    LegacyClangParsingEnvironmentFileData()
+        : ParsingEnvironmentFileData()
+        , environmentHash(0)
+        , tuUrl()
+        , quality(ClangParsingEnvironment::Unknown)
+    {
+    }
+
+    LegacyClangParsingEnvironmentFileData(const LegacyClangParsingEnvironmentFileData& rhs)
+        : ParsingEnvironmentFileData(rhs)
+        , environmentHash(rhs.environmentHash)
+        , tuUrl(rhs.tuUrl)
+        , quality(rhs.quality)
+    {
+    }
+
+    ~LegacyClangParsingEnvironmentFileData() = default;
+
+    uint environmentHash;
+    IndexedString tuUrl;
+    ClangParsingEnvironment::Quality quality;
+};
+
 class ClangParsingEnvironmentFileData : public ParsingEnvironmentFileData
 {
 public:
@@ -37,6 +67,7 @@ public:
         , environmentHash(0)
         , tuUrl()
         , quality(ClangParsingEnvironment::Unknown)
+        , contentHash(0)
     {
     }
 
@@ -45,6 +76,7 @@ public:
         , environmentHash(rhs.environmentHash)
         , tuUrl(rhs.tuUrl)
         , quality(rhs.quality)
+        , contentHash(rhs.contentHash)
     {
     }
 
@@ -53,6 +85,7 @@ public:
     uint environmentHash;
     IndexedString tuUrl;
     ClangParsingEnvironment::Quality quality;
+    quint64 contentHash;
 };
 
 ClangParsingEnvironmentFile::ClangParsingEnvironmentFile(const IndexedString& url,
@@ -77,6 +110,19 @@ int ClangParsingEnvironmentFile::type() const
 }
 
 bool ClangParsingEnvironmentFile::needsUpdate(const ParsingEnvironment* environment) const
+{
+    if (environmentNeedsUpdate(environment)) {
+        return true;
+    }
+
+    bool ret = KDevelop::ParsingEnvironmentFile::needsUpdate(environment);
+    if (ret) {
+        clangDebug() << "modification revision requires update:" << url();
+    }
+    return ret;
+}
+
+bool ClangParsingEnvironmentFile::environmentNeedsUpdate(const ParsingEnvironment* environment) const
 {
     if (environment) {
         Q_ASSERT(dynamic_cast<const ClangParsingEnvironment*>(environment));
@@ -92,12 +138,34 @@ bool ClangParsingEnvironmentFile::needsUpdate(const ParsingEnvironment* environm
             return true;
         }
     }
+    return false;
+}
 
-    bool ret = KDevelop::ParsingEnvironmentFile::needsUpdate(environment);
-    if (ret) {
-        clangDebug() << "modification revision requires update:" << url();
+bool ClangParsingEnvironmentFile::isContentUnchanged(const ParsingEnvironment* environment, quint64 contentHash) const
+{
+    if (environmentNeedsUpdate(environment)) {
+        return false;
     }
-    return ret;
+
+    const auto revision = ModificationRevision::revisionForFile(url());
+    if (revision == modificationRevision()) {
+        return true;
+    }
+    if (revision.revision != modificationRevision().revision || !d_func()->contentHash || !contentHash) {
+        // edited in the editor, or the content that got parsed is unknown
+        return false;
+    }
+
+    const bool unchanged = contentHash == d_func()->contentHash;
+    if (unchanged) {
+        clangDebug() << "file touched but content unchanged, skipping update:" << url();
+    }
+    return unchanged;
+}
+
+void ClangParsingEnvironmentFile::setContentHash(quint64 contentHash)
+{
+    d_func_dynamic()->contentHash = contentHash;
 }
 
 void ClangParsingEnvironmentFile::setEnvironment(const ClangParsingEnvironment& environment)
@@ -123,3 +191,28 @@ uint ClangParsingEnvironmentFile::environmentHash() const
 }
 
 DUCHAIN_DEFINE_TYPE(ClangParsingEnvironmentFile)
+
+LegacyClangParsingEnvironmentFile::LegacyClangParsingEnvironmentFile(LegacyClangParsingEnvironmentFileData& data)
+    : ParsingEnvironmentFile(data)
+{
+}
+
+LegacyClangParsingEnvironmentFile::~LegacyClangParsingEnvironmentFile() = default;
+
+int LegacyClangParsingEnvironmentFile::type() const
+{
+    return CppParsingEnvironment;
+}
+
+bool LegacyClangParsingEnvironmentFile::needsUpdate(const ParsingEnvironment* /*environment*/) const
+{
+    return true;
+}
+
+bool LegacyClangParsingEnvironmentFile::matchEnvironment(const ParsingEnvironment* /*environment*/) const
+{
+    // never reuse these contexts, they get rebuilt with a ClangParsingEnvironmentFile
+    return false;
+}
+
+DUCHAIN_DEFINE_TYPE(LegacyClangParsingEnvironmentFile)
@@ -29,6 +29,7 @@
 #include <duchain/clangduchainexport.h>
 
 class ClangParsingEnvironmentFileData;
+class LegacyClangParsingEnvironmentFileData;
 
 class KDEVCLANGDUCHAIN_EXPORT ClangParsingEnvironmentFile : public KDevelop::ParsingEnvironmentFile
 {
@@ -50,14 +51,57 @@ public:
 
     uint environmentHash() const;
 
+    /**
+     * Store the fingerprint of the content this file got parsed from, see ParseSession::contentHash().
+     * Pass 0 when it is unknown, e.g. when this file got parsed from its unsaved contents.
+     */
+    void setContentHash(quint64 contentHash);
+
+    /**
+     * @return true when this file was only touched on disk since the last update,
+     *         i.e. the @p environment and its content fingerprint did not change.
+     *
+     * @param contentHash The fingerprint of the content that just got parsed, see ParseSession::contentHash().
+     */
+    bool isContentUnchanged(const KDevelop::ParsingEnvironment* environment, quint64 contentHash) const;
+
     enum {
-        Identity = 142
+        // the layout of the data changed, the data of Identity 142 is read by LegacyClangParsingEnvironmentFile
+        Identity = 144
     };
 
 private:
+    bool environmentNeedsUpdate(const KDevelop::ParsingEnvironment* environment) const;
+
     DUCHAIN_DECLARE_DATA(ClangParsingEnvironmentFile)
 };
 
 DUCHAIN_DECLARE_TYPE(ClangParsingEnvironmentFile)
 
+/**
+ * Reads the environment files of sessions created before the data layout of
+ * ClangParsingEnvironmentFile changed. They never match any environment, so
+ * the contexts get rebuilt.
+ */
+class KDEVCLANGDUCHAIN_EXPORT LegacyClangParsingEnvironmentFile : public KDevelop::ParsingEnvironmentFile
+{
+public:
+    LegacyClangParsingEnvironmentFile(LegacyClangParsingEnvironmentFileData& data);
+    ~LegacyClangParsingEnvironmentFile();
+
+    virtual bool needsUpdate(const KDevelop::ParsingEnvironment* environment = 0) const override;
+    virtual int type() const override;
+
+    virtual bool matchEnvironment(const KDevelop::ParsingEnvironment* environment) const override;
+
+    enum {
+        Identity = 142
+    };
+
+private:
+    DUCHAIN_DECLARE_DATA(LegacyClangParsingEnvironmentFile)
+};
+
+DUCHAIN_DECLARE_TYPE(LegacyClangParsingEnvironmentFile)
+
 #endif // CLANGPARSINGENVIRONMENTFILE_H
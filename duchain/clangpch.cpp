@@ -41,16 +41,10 @@ inline CXFile mapFile(CXFile file, CXTranslationUnit tu)
 ClangPCH::ClangPCH(const ClangParsingEnvironment& environment, ClangIndex* index)
     : m_session({})
 {
-    const auto& pchInclude = environment.pchInclude();
-    Q_ASSERT(pchInclude.isValid());
+    Q_ASSERT(!environment.pchInclude().isValid());
 
     const TopDUContext::Features pchFeatures = TopDUContext::AllDeclarationsContextsUsesAndAST;
-    const IndexedString doc(pchInclude.pathOrUrl());
-
-    ClangParsingEnvironment pchEnv;
-    pchEnv.setPchInclude(Path());
-    pchEnv.setTranslationUnitUrl(doc);
-    m_session.setData(ParseSessionData::Ptr(new ParseSessionData({}, index, pchEnv, ParseSessionData::PrecompiledHeader)));
+    m_session.setData(ParseSessionData::Ptr(new ParseSessionData({}, index, environment, ParseSessionData::PrecompiledHeader)));
 
     if (!m_session.unit()) {
         return;
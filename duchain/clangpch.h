@@ -32,6 +32,9 @@ class ClangParsingEnvironment;
 class KDEVCLANGDUCHAIN_EXPORT ClangPCH
 {
 public:
+    /**
+     * Parse the header which is the translation unit of @p environment and save it as PCH next to it
+     */
     ClangPCH(const ClangParsingEnvironment& environment, ClangIndex* index);
 
     IncludeFileContexts mapIncludes(CXTranslationUnit tu) const;
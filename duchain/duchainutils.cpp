@@ -60,6 +60,7 @@ void DUChainUtils::registerDUChainItems()
 {
     duchainRegisterType<ClangTopDUContext>();
     duchainRegisterType<ClangParsingEnvironmentFile>();
+    duchainRegisterType<LegacyClangParsingEnvironmentFile>();
     duchainRegisterType<ClangNormalDUContext>();
     duchainRegisterType<MacroDefinition>();
 
@@ -78,6 +79,7 @@ void DUChainUtils::unregisterDUChainItems()
 /*
     duchainUnregisterType<ClangTopDUContext>();
     duchainUnregisterType<ClangParsingEnvironmentFile>();
+    duchainUnregisterType<LegacyClangParsingEnvironmentFile>();
     duchainUnregisterType<ClangNormalDUContext>();
     duchainUnregisterType<MacroDefinition>();
 
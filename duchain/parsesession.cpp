@@ -29,16 +29,19 @@
 #include "clangindex.h"
 #include "clangparsingenvironment.h"
 #include "util/clangdebug.h"
+#include "util/clangprofiler.h"
 #include "util/clangtypes.h"
 #include "util/clangutils.h"
 
 #include <language/duchain/duchainlock.h>
 #include <language/duchain/duchain.h>
 
+#include <QCryptographicHash>
 #include <QDir>
 #include <QFileInfo>
 #include <QMimeDatabase>
 #include <QMimeType>
+#include <QtEndian>
 
 #include <algorithm>
 
@@ -88,6 +91,24 @@ void addIncludes(QVector<const char*>* args, QVector<QByteArray>* otherArgs,
     }
 }
 
+/// @return the memory used by @p unit in bytes
+quint64 memoryUsage(CXTranslationUnit unit)
+{
+    quint64 usage = 0;
+    auto resourceUsage = clang_getCXTUResourceUsage(unit);
+    for (unsigned i = 0; i < resourceUsage.numEntries; ++i) {
+        usage += resourceUsage.entries[i].amount;
+    }
+    clang_disposeCXTUResourceUsage(resourceUsage);
+    return usage;
+}
+
+/// @return the first 64 bits of @p hash, never 0 as that marks an unknown fingerprint
+quint64 fingerprint(const QCryptographicHash& hash)
+{
+    return qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(hash.result().constData())) | 1;
+}
+
 QVector<CXUnsavedFile> toClangApi(const QVector<UnsavedFile>& unsavedFiles)
 {
     QVector<CXUnsavedFile> unsaved;
@@ -104,7 +125,22 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
                                    const ClangParsingEnvironment& environment, Options options)
     : m_file(nullptr)
     , m_unit(nullptr)
+    , m_index(index)
+    , m_options(options)
 {
+    parse(unsavedFiles, environment);
+    if (!m_unit && m_index && !m_options.testFlag(PrecompiledHeader)) {
+        // register anyways, such that the index can detach us when it gets destroyed first
+        m_index->updateSession(this, 0);
+    }
+}
+
+void ParseSessionData::parse(const QVector<UnsavedFile>& unsavedFiles, const ClangParsingEnvironment& environment)
+{
+    auto index = m_index;
+    const auto options = m_options;
+    m_evicted = false;
+
     unsigned int flags = CXTranslationUnit_CXXChainedPCH
         | CXTranslationUnit_DetailedPreprocessingRecord;
     if (options.testFlag(SkipFunctionBodies)) {
@@ -147,21 +183,17 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
     addIncludes(&clangArguments, &smartArgs, includes.system, "-isystem");
     addIncludes(&clangArguments, &smartArgs, includes.project, "-I");
 
-    m_definesFile.open();
-    QTextStream definesStream(&m_definesFile);
-    Q_ASSERT(m_definesFile.isWritable());
-    const auto& defines = environment.defines();
-    for (auto it = defines.begin(); it != defines.end(); ++it) {
-        definesStream << QStringLiteral("#define ") << it.key() << ' ' << it.value() << '\n';
-    }
-    definesStream.flush();
-    smartArgs << m_definesFile.fileName().toUtf8();
+    m_definesFile = index->definesFile(environment);
+    smartArgs << m_definesFile->fileName().toUtf8();
     clangArguments << "-imacros" << smartArgs.last().constData();
 
     QVector<CXUnsavedFile> unsaved;
     //For PrecompiledHeader, we don't want unsaved contents (and contents.isEmpty())
     if (!options.testFlag(PrecompiledHeader)) {
         unsaved = toClangApi(unsavedFiles);
+        setUnsavedFiles(unsavedFiles);
+    } else {
+        setUnsavedFiles({});
     }
 
     const CXErrorCode code = clang_parseTranslationUnit2(
@@ -176,8 +208,8 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
     }
 
     if (m_unit) {
-        setUnit(m_unit);
         m_environment = environment;
+        setUnit(m_unit);
 
         if (options.testFlag(PrecompiledHeader)) {
             clang_saveTranslationUnit(m_unit, (tuUrl.byteArray() + ".pch").constData(), CXSaveTranslationUnit_None);
@@ -189,6 +221,11 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
 
 ParseSessionData::~ParseSessionData()
 {
+    if (m_index && !m_options.testFlag(PrecompiledHeader)) {
+        m_index->unregisterSession(this);
+        // wait for an eviction of this session that started before it got unregistered
+        QMutexLocker lock(&m_mutex);
+    }
     clang_disposeTranslationUnit(m_unit);
 }
 
@@ -197,8 +234,33 @@ void ParseSessionData::setUnit(CXTranslationUnit unit)
     Q_ASSERT(!m_unit || unit == m_unit);
 
     m_unit = unit;
+    m_revision.ref();
     const ClangString unitFile(clang_getTranslationUnitSpelling(unit));
     m_file = clang_getFile(m_unit, unitFile.c_str());
+
+    // PCH sessions are never evicted, their files are mapped into other translation units
+    if (m_index && !m_options.testFlag(PrecompiledHeader)) {
+        // query the usage before the index locks its sessions, other threads wait on that lock
+        const auto usage = memoryUsage(m_unit);
+        m_index->updateSession(this, usage);
+    }
+}
+
+void ParseSessionData::setUnsavedFiles(const QVector<UnsavedFile>& unsavedFiles)
+{
+    m_unsavedFiles.clear();
+    for (const auto& file : unsavedFiles) {
+        m_unsavedFiles.insert(IndexedString(file.fileName()));
+    }
+}
+
+void ParseSessionData::evict()
+{
+    clangDebug() << "evicting translation unit to stay within memory budget:" << m_environment.translationUnitUrl();
+    clang_disposeTranslationUnit(m_unit);
+    m_unit = nullptr;
+    m_file = nullptr;
+    m_evicted = true;
 }
 
 ClangParsingEnvironment ParseSessionData::environment() const
@@ -206,12 +268,20 @@ ClangParsingEnvironment ParseSessionData::environment() const
     return m_environment;
 }
 
+int ParseSessionData::revision() const
+{
+    return m_revision.load();
+}
+
 ParseSession::ParseSession(const ParseSessionData::Ptr& data)
     : d(data)
 {
     if (d) {
         ENSURE_CHAIN_NOT_LOCKED
         d->m_mutex.lock();
+        if (d->m_index) {
+            d->m_index->touchSession(d.data());
+        }
     }
 }
 
@@ -237,6 +307,9 @@ void ParseSession::setData(const ParseSessionData::Ptr& data)
     if (d) {
         ENSURE_CHAIN_NOT_LOCKED
         d->m_mutex.lock();
+        if (d->m_index) {
+            d->m_index->touchSession(d.data());
+        }
     }
 }
 
@@ -257,6 +330,10 @@ QList<ProblemPointer> ParseSession::problemsForFile(CXFile file) const
         return {};
     }
 
+    const QString path = QDir::cleanPath(ClangString(clang_getFileName(file)).toString());
+    const IndexedString indexedPath(path);
+    ClangProfiler::Scope profile("problems", path);
+
     QList<ProblemPointer> problems;
 
     // extra clang diagnostics
@@ -278,11 +355,11 @@ QList<ProblemPointer> ParseSession::problemsForFile(CXFile file) const
         clang_disposeDiagnostic(diagnostic);
     }
 
-    const QString path = QDir::cleanPath(ClangString(clang_getFileName(file)).toString());
-    const IndexedString indexedPath(path);
-
-    TodoExtractor extractor(unit(), file);
-    problems << extractor.problems();
+    {
+        ClangProfiler::Scope profile("todo", path);
+        TodoExtractor extractor(unit(), file);
+        problems << extractor.problems();
+    }
 
     // other problem sources
     if (ClangHelpers::isHeader(path) && !clang_isFileMultipleIncludeGuarded(unit(), file)
@@ -319,13 +396,14 @@ CXFile ParseSession::mainFile() const
 
 bool ParseSession::reparse(const QVector<UnsavedFile>& unsavedFiles, const ClangParsingEnvironment& environment)
 {
-    if (!d || environment != d->m_environment) {
+    if (!d || !d->m_unit || environment != d->m_environment) {
         return false;
     }
 
     auto unsaved = toClangApi(unsavedFiles);
 
     if (clang_reparseTranslationUnit(d->m_unit, unsaved.size(), unsaved.data(), clang_defaultReparseOptions(d->m_unit)) == 0) {
+        d->setUnsavedFiles(unsavedFiles);
         d->setUnit(d->m_unit);
         return true;
     } else {
@@ -333,6 +411,54 @@ bool ParseSession::reparse(const QVector<UnsavedFile>& unsavedFiles, const Clang
     }
 }
 
+bool ParseSession::hasUnsavedContents(const IndexedString& path) const
+{
+    return d && d->m_unsavedFiles.contains(path);
+}
+
+quint64 ParseSession::contentHash(CXFile file) const
+{
+    if (!d || !d->m_unit || !file) {
+        return 0;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+#if CINDEX_VERSION_MINOR >= 47
+    size_t size = 0;
+    const char* contents = clang_getFileContents(d->m_unit, file, &size);
+    if (!contents) {
+        return 0;
+    }
+    hash.addData(contents, size);
+#else
+    // the content on disk is only what got parsed if it was not modified since
+    QFile input(ClangString(clang_getFileName(file)).toString());
+    if (!input.open(QIODevice::ReadOnly) || !hash.addData(&input)
+        || static_cast<time_t>(QFileInfo(input).lastModified().toTime_t()) != clang_getFileTime(file))
+    {
+        return 0;
+    }
+#endif
+    return fingerprint(hash);
+}
+
+bool ParseSession::isCompletable() const
+{
+    return d && !d->m_evicted;
+}
+
+void ParseSession::ensureCompletable(const QVector<UnsavedFile>& unsavedFiles)
+{
+    if (!d || isCompletable()) {
+        return;
+    }
+
+    clang_disposeTranslationUnit(d->m_unit);
+    d->m_unit = nullptr;
+    d->m_file = nullptr;
+    d->parse(unsavedFiles, d->m_environment);
+}
+
 ClangParsingEnvironment ParseSession::environment() const
 {
     return d->m_environment;
@@ -23,8 +23,11 @@
 #ifndef PARSESESSION_H
 #define PARSESESSION_H
 
+#include <QAtomicInt>
 #include <QList>
+#include <QSet>
 #include <QUrl>
+#include <QSharedPointer>
 #include <QTemporaryFile>
 
 #include <clang-c/Index.h>
@@ -67,19 +70,41 @@ public:
 
     ClangParsingEnvironment environment() const;
 
+    /**
+     * @return a number which changes whenever the translation unit gets parsed again
+     *
+     * This function is thread safe.
+     */
+    int revision() const;
+
 private:
     friend class ParseSession;
+    friend class ClangIndex;
 
+    void parse(const QVector<UnsavedFile>& unsavedFiles, const ClangParsingEnvironment& environment);
     void setUnit(CXTranslationUnit unit);
 
+    /// Dispose the translation unit to free its memory, see ClangIndex::setTranslationUnitMemoryBudget
+    void evict();
+
+    /// Remember which files got parsed from their unsaved contents
+    void setUnsavedFiles(const QVector<UnsavedFile>& unsavedFiles);
+
     QMutex m_mutex;
 
+    ClangIndex* m_index = nullptr;
+    Options m_options;
+    bool m_evicted = false;
+    QAtomicInt m_revision;
+
     CXFile m_file = nullptr;
     CXTranslationUnit m_unit = nullptr;
     ClangParsingEnvironment m_environment;
-    /// TODO: share this file for all TUs that use the same defines (probably most in a project)
-    ///       best would be a PCH, if possible
-    QTemporaryFile m_definesFile;
+    /// shared with all other TUs that use the same defines, see ClangIndex::definesFile
+    QSharedPointer<const QTemporaryFile> m_definesFile;
+
+    /// the files which got parsed from their unsaved contents in the editor
+    QSet<KDevelop::IndexedString> m_unsavedFiles;
 };
 
 /**
@@ -127,6 +152,30 @@ public:
 
     bool reparse(const QVector<UnsavedFile>& unsavedFiles, const ClangParsingEnvironment& environment);
 
+    /**
+     * @return true when @p path got parsed from its unsaved contents in the editor, not from disk
+     */
+    bool hasUnsavedContents(const KDevelop::IndexedString& path) const;
+
+    /**
+     * @return a fingerprint of the content @p file got parsed from, or 0 if it is unknown
+     *
+     * This hashes the whole file, never call it while holding the DUChain lock.
+     */
+    quint64 contentHash(CXFile file) const;
+
+    /**
+     * @return false when the translation unit got evicted to stay within the memory budget, see ensureCompletable()
+     */
+    bool isCompletable() const;
+
+    /**
+     * Parse the translation unit again with @p unsavedFiles if it got evicted.
+     *
+     * This can take as long as a parse job, never call it from the GUI thread.
+     */
+    void ensureCompletable(const QVector<UnsavedFile>& unsavedFiles);
+
     ClangParsingEnvironment environment() const;
 
 private:
@@ -33,6 +33,13 @@ UnsavedFile::UnsavedFile(const QString& fileName, const QStringList& contents)
 {
 }
 
+UnsavedFile::UnsavedFile(const QString& fileName, const QByteArray& contentsUtf8)
+    : m_fileName(fileName)
+    , m_fileNameUtf8(fileName.toUtf8())
+    , m_contentsUtf8(contentsUtf8)
+{
+}
+
 CXUnsavedFile UnsavedFile::toClangApi() const
 {
     if (m_fileNameUtf8.isEmpty()) {
@@ -47,6 +54,11 @@ CXUnsavedFile UnsavedFile::toClangApi() const
     return file;
 }
 
+QString UnsavedFile::fileName() const
+{
+    return m_fileName;
+}
+
 void UnsavedFile::convertToUtf8()
 {
     m_fileNameUtf8 = m_fileName.toUtf8();
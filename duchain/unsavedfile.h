@@ -22,6 +22,7 @@
 #ifndef UNSAVEDFILE_H
 #define UNSAVEDFILE_H
 
+#include <QMetaType>
 #include <QStringList>
 
 struct CXUnsavedFile;
@@ -33,9 +34,18 @@ class UnsavedFile
 {
 public:
     UnsavedFile(const QString& fileName = {}, const QStringList& contents = {});
+    /**
+     * Create an unsaved file from already UTF-8 encoded @p contents.
+     *
+     * The contents are shared, not copied, so keeping a copy of the returned object
+     * is a cheap way to reuse the contents in later parse jobs.
+     */
+    UnsavedFile(const QString& fileName, const QByteArray& contentsUtf8);
 
     CXUnsavedFile toClangApi() const;
 
+    QString fileName() const;
+
 private:
     QString m_fileName;
     QStringList m_contents;
@@ -46,5 +56,6 @@ private:
 };
 
 Q_DECLARE_TYPEINFO(UnsavedFile, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(UnsavedFile)
 
 #endif // UNSAVEDFILE_H
@@ -0,0 +1,56 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "clangindexer.h"
+
+#include "clangenvironmentcache.h"
+#include "duchain/clanghelpers.h"
+#include "duchain/clangindex.h"
+#include "duchain/clangparsingenvironment.h"
+#include "duchain/clangpch.h"
+#include "duchain/parsesession.h"
+
+using namespace KDevelop;
+
+ReferencedTopDUContext ClangIndexer::indexTranslationUnit(ClangIndex* index, ClangEnvironmentCache* environmentCache,
+                                                          const ClangParsingEnvironment& environment,
+                                                          TopDUContext::Features features)
+{
+    auto fullEnvironment = environment;
+    environmentCache->addBackgroundEnvironment(&fullEnvironment);
+
+    const bool skipFunctionBodies = (features <= TopDUContext::VisibleDeclarationsAndContexts);
+    ParseSession session(ParseSessionData::Ptr(new ParseSessionData({}, index, fullEnvironment,
+                         (skipFunctionBodies ? ParseSessionData::SkipFunctionBodies : ParseSessionData::NoOption))));
+    if (!session.unit()) {
+        return {};
+    }
+
+    auto imports = ClangHelpers::tuImports(session.unit());
+    IncludeFileContexts includedFiles;
+    if (auto pch = index->pch(fullEnvironment)) {
+        auto pchFile = pch->mapFile(session.unit());
+        includedFiles = pch->mapIncludes(session.unit());
+        includedFiles.insert(pchFile, pch->context());
+        auto tuFile = clang_getFile(session.unit(), fullEnvironment.translationUnitUrl().byteArray().constData());
+        imports.insert(tuFile, { pchFile, CursorInRevision(0, 0) } );
+    }
+
+    return ClangHelpers::buildDUChain(session.mainFile(), imports, session, features, includedFiles, index);
+}
@@ -0,0 +1,48 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef CLANGINDEXER_H
+#define CLANGINDEXER_H
+
+#include <language/duchain/topducontext.h>
+
+class ClangEnvironmentCache;
+class ClangIndex;
+class ClangParsingEnvironment;
+
+namespace ClangIndexer {
+
+/**
+ * Parse the translation unit of @p environment and build its DUChain the way a ClangParseJob
+ * without unsaved documents does, such that the IDE can reuse the result without a rebuild.
+ *
+ * @p environment must be computed with ClangEnvironmentCache::environment(), the parts which
+ * are only queried in the background and the user defined PCH include are added by this function.
+ *
+ * This function is thread safe.
+ *
+ * @return the top context of the translation unit, or a null context if it could not be parsed
+ */
+KDevelop::ReferencedTopDUContext indexTranslationUnit(ClangIndex* index, ClangEnvironmentCache* environmentCache,
+                                                      const ClangParsingEnvironment& environment,
+                                                      KDevelop::TopDUContext::Features features);
+
+}
+
+#endif // CLANGINDEXER_H
@@ -0,0 +1,284 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <shell/core.h>
+
+#include <interfaces/ilanguagecontroller.h>
+#include <interfaces/iprojectcontroller.h>
+#include <interfaces/isession.h>
+#include <language/backgroundparser/backgroundparser.h>
+#include <language/duchain/duchain.h>
+
+#include "clangindexer.h"
+#include "clangenvironmentcache.h"
+#include "duchain/clangindex.h"
+#include "duchain/clangparsingenvironment.h"
+
+#include <KConfigGroup>
+
+#include <QApplication>
+#include <QAtomicInt>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace KDevelop;
+
+namespace {
+
+QTextStream qout(stdout);
+QTextStream qerr(stderr);
+
+/**
+ * @return the translation units listed in the compilation database @p fileName
+ *
+ * The include paths and defines of the compile commands are not used, the environments are computed
+ * from the projects of the session like the IDE does. Otherwise the IDE would build everything again.
+ */
+QVector<IndexedString> readCompilationDatabase(const QString& fileName, QString* error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = file.errorString();
+        return {};
+    }
+
+    QJsonParseError parseError;
+    const auto document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (!document.isArray()) {
+        *error = parseError.errorString();
+        return {};
+    }
+
+    QVector<IndexedString> files;
+    QSet<IndexedString> knownFiles;
+    foreach (const auto& value, document.array()) {
+        const auto entry = value.toObject();
+        const QDir directory(entry.value(QStringLiteral("directory")).toString());
+        const IndexedString file(QDir::cleanPath(directory.absoluteFilePath(entry.value(QStringLiteral("file")).toString())));
+        // a file may be compiled several times, e.g. for different targets, index it once
+        if (!knownFiles.contains(file)) {
+            knownFiles.insert(file);
+            files << file;
+        }
+    }
+    return files;
+}
+
+/**
+ * Wait until the projects of the active session got opened, as the environments are computed from them
+ *
+ * @return false if not all of them got opened within @p timeout milliseconds
+ */
+bool waitForProjects(int timeout)
+{
+    // the project controller opens the projects stored in the session on startup
+    const auto group = ICore::self()->activeSession()->config()->group("General Options");
+    const int expected = group.readEntry("Open Projects", QList<QUrl>()).size();
+    auto projectController = ICore::self()->projectController();
+
+    QElapsedTimer timer;
+    timer.start();
+    while (projectController->projectCount() < expected) {
+        if (timer.elapsed() > timeout) {
+            return false;
+        }
+        QEventLoop loop;
+        QObject::connect(projectController, &IProjectController::projectOpened, &loop, &QEventLoop::quit);
+        QTimer::singleShot(100, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    return true;
+}
+
+/// @return the peak resident set size of this process in KiB, or 0 if unknown
+qint64 peakRss()
+{
+#ifdef Q_OS_UNIX
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MAC
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+struct Indexer
+{
+    ClangIndex index;
+    ClangEnvironmentCache environmentCache;
+    TopDUContext::Features features = TopDUContext::AllDeclarationsContextsAndUses;
+    QAtomicInt indexed;
+    QAtomicInt failed;
+    int total = 0;
+    bool verbose = false;
+    QMutex outputMutex;
+};
+
+class IndexRunnable : public QRunnable
+{
+public:
+    IndexRunnable(Indexer* indexer, const ClangParsingEnvironment& environment)
+        : m_indexer(indexer)
+        , m_environment(environment)
+    {
+    }
+
+    void run() override
+    {
+        const auto context = ClangIndexer::indexTranslationUnit(&m_indexer->index, &m_indexer->environmentCache,
+                                                                m_environment, m_indexer->features);
+        const bool success = context.data();
+
+        const int done = m_indexer->indexed.fetchAndAddOrdered(1) + 1;
+        if (!success) {
+            m_indexer->failed.fetchAndAddOrdered(1);
+        }
+        if (m_indexer->verbose || !success) {
+            QMutexLocker lock(&m_indexer->outputMutex);
+            auto& stream = success ? qout : qerr;
+            stream << '[' << done << '/' << m_indexer->total << "] "
+                   << (success ? "indexed " : "failed to index ") << m_environment.translationUnitUrl().str() << endl;
+        }
+    }
+
+private:
+    Indexer* m_indexer;
+    ClangParsingEnvironment m_environment;
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    // the indexer is meant to run in headless nightly jobs
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+    QApplication::setApplicationName(QStringLiteral("kdev-clang-indexer"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Index all translation units of a compilation database into the DUChain of a KDevelop session."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("compile_commands.json"),
+                                 QStringLiteral("The compilation database listing the translation units to index."));
+    QCommandLineOption sessionOption(QStringLiteral("session"),
+                                     QStringLiteral("The KDevelop session to store the DUChain in."),
+                                     QStringLiteral("name"));
+    QCommandLineOption projectTimeoutOption(QStringLiteral("project-timeout"),
+                                            QStringLiteral("The number of seconds to wait for the projects of the session to be opened."),
+                                            QStringLiteral("seconds"), QStringLiteral("600"));
+    QCommandLineOption threadsOption(QStringLiteral("threads"),
+                                     QStringLiteral("The number of translation units indexed in parallel."),
+                                     QStringLiteral("count"), QString::number(QThread::idealThreadCount()));
+    QCommandLineOption visibleOnlyOption(QStringLiteral("visible-only"),
+                                         QStringLiteral("Only index visible declarations and contexts, as the IDE does for closed files."));
+    QCommandLineOption verboseOption(QStringLiteral("verbose"),
+                                     QStringLiteral("Print every indexed translation unit."));
+    parser.addOptions({sessionOption, projectTimeoutOption, threadsOption, visibleOnlyOption, verboseOption});
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1 || !parser.isSet(sessionOption)) {
+        parser.showHelp(1);
+    }
+
+    const auto databasePath = QFileInfo(parser.positionalArguments().first()).absoluteFilePath();
+    QString error;
+    const auto files = readCompilationDatabase(databasePath, &error);
+    if (files.isEmpty()) {
+        qerr << "no translation units found in " << databasePath << ": " << error << endl;
+        return 1;
+    }
+
+    // a regular core, such that the projects of the session are opened like in the IDE
+    if (!Core::initialize(nullptr, Core::NoUi, parser.value(sessionOption))) {
+        qerr << "failed to initialize the session " << parser.value(sessionOption) << endl;
+        return 1;
+    }
+    // the projects schedule their files for parsing when opened, that is what the indexer does instead
+    ICore::self()->languageController()->backgroundParser()->suspend();
+
+    if (!waitForProjects(parser.value(projectTimeoutOption).toInt() * 1000)) {
+        qerr << "failed to open the projects of the session " << parser.value(sessionOption) << endl;
+        Core::self()->shutdown();
+        return 1;
+    }
+
+    // destroy the index, and with it all translation units, before shutting down the DUChain
+    QScopedPointer<Indexer> indexer(new Indexer);
+    indexer->total = files.size();
+    indexer->verbose = parser.isSet(verboseOption);
+    if (parser.isSet(visibleOnlyOption)) {
+        indexer->features = TopDUContext::VisibleDeclarationsAndContexts;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, parser.value(threadsOption).toInt()));
+
+    QElapsedTimer timer;
+    timer.start();
+    for (const auto& file : files) {
+        // the environment cache may only be queried from the main thread
+        QString projectName;
+        const auto tuUrl = indexer->index.translationUnitForUrl(file);
+        pool.start(new IndexRunnable(indexer.data(), indexer->environmentCache.environment(tuUrl, &projectName)));
+    }
+    while (!pool.waitForDone(100)) {
+        QCoreApplication::processEvents();
+    }
+    const auto elapsed = timer.elapsed();
+
+    DUChain::self()->storeToDisk();
+
+    const double seconds = qMax<qint64>(elapsed, 1) / 1000.0;
+    qout << "indexed " << indexer->total - indexer->failed.load() << " of " << indexer->total
+         << " translation units in " << seconds << "s (" << indexer->total / seconds << " TUs/s), peak RSS "
+         << peakRss() / 1024 << " MiB" << endl;
+
+    const bool failed = indexer->failed.load();
+    indexer.reset();
+
+    Core::self()->shutdown();
+    return failed ? 2 : 0;
+}
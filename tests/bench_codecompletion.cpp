@@ -0,0 +1,310 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "bench_codecompletion.h"
+
+#include <tests/testcore.h>
+#include <tests/autotestshell.h>
+#include <language/duchain/duchain.h>
+#include <language/duchain/duchainlock.h>
+
+#include <custom-definesandincludes/idefinesandincludesmanager.h>
+
+#include "duchain/clanghelpers.h"
+#include "duchain/clangparsingenvironment.h"
+#include "duchain/parsesession.h"
+#include "codecompletion/completionhelper.h"
+#include "codecompletion/context.h"
+#include "codecompletion/documentmirror.h"
+#include "../clangsettings/clangsettingsmanager.h"
+
+#include <KTextEditor/Cursor>
+#include <KTextEditor/Document>
+#include <KTextEditor/Editor>
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QLibraryInfo>
+
+#include <algorithm>
+
+QTEST_MAIN(BenchCodeCompletion)
+
+using namespace KDevelop;
+
+namespace {
+
+/// Number of completions requested at every cursor position
+const int Runs = 5;
+
+/// Marks a completion position in the benchmarked sources, removed before parsing
+const QChar Marker = QLatin1Char('$');
+
+struct Source
+{
+    QString code;
+    QVector<KTextEditor::Cursor> positions;
+};
+
+Source makeSource(const QString& markedCode)
+{
+    Source source;
+    int line = 0;
+    int column = 0;
+    for (const auto c : markedCode) {
+        if (c == Marker) {
+            source.positions.append({line, column});
+            continue;
+        }
+        source.code += c;
+        if (c == QLatin1Char('\n')) {
+            ++line;
+            column = 0;
+        } else {
+            ++column;
+        }
+    }
+    return source;
+}
+
+QString stlSource()
+{
+    return QStringLiteral(
+        "#include <vector>\n"
+        "#include <map>\n"
+        "#include <string>\n"
+        "#include <memory>\n"
+        "#include <algorithm>\n"
+        "int main() {\n"
+        "    std::vector<std::string> strings;\n"
+        "    std::map<std::string, std::vector<int>> map;\n"
+        "    auto ptr = std::make_shared<std::string>();\n"
+        "    strings.$push_back(\"\");\n"
+        "    map.begin()->second.$size();\n"
+        "    ptr->$size();\n"
+        "    std::$sort(strings.begin(), strings.end());\n"
+        "    $\n"
+        "}\n");
+}
+
+QString qtSource()
+{
+    return QStringLiteral(
+        "#include <QString>\n"
+        "#include <QVector>\n"
+        "#include <QHash>\n"
+        "#include <QObject>\n"
+        "class Worker : public QObject {\n"
+        "public:\n"
+        "    void run() {\n"
+        "        QString string;\n"
+        "        string.$append(QStringLiteral(\"\"));\n"
+        "        QHash<QString, QVector<int>> hash;\n"
+        "        hash.$value(string).$size();\n"
+        "        this->$deleteLater();\n"
+        "        $\n"
+        "    }\n"
+        "};\n");
+}
+
+QString bigClassSource()
+{
+    QString code = QStringLiteral("struct Big {\n");
+    for (int i = 0; i < 2000; ++i) {
+        code += QStringLiteral("    int member%1;\n    void method%1(int arg);\n").arg(i);
+    }
+    code += QStringLiteral("};\n"
+                           "void use(Big& big, Big* ptr) {\n"
+                           "    big.$member0 = 1;\n"
+                           "    ptr->$method0(big.$member1);\n"
+                           "    $\n"
+                           "}\n");
+    return code;
+}
+
+/// @return the nearest-rank @p percentile of @p sorted in microseconds
+double percentile(const QVector<qint64>& sorted, int percentile)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+    const int rank = std::max(1, (percentile * sorted.size() + 99) / 100);
+    return sorted.at(rank - 1) / 1000.0;
+}
+
+void report(const char* stage, QVector<qint64> times)
+{
+    std::sort(times.begin(), times.end());
+    qDebug() << stage << "p50:" << percentile(times, 50) << "us p95:" << percentile(times, 95)
+             << "us p99:" << percentile(times, 99) << "us";
+}
+
+}
+
+void BenchCodeCompletion::initTestCase()
+{
+    QLoggingCategory::setFilterRules(QStringLiteral("*.debug=false\ndefault.debug=true\n"));
+    QVERIFY(qputenv("KDEV_DISABLE_PLUGINS", "kdevcppsupport"));
+    AutoTestShell::init();
+    TestCore::initialize(Core::NoUi);
+    DUChain::self()->disablePersistentStorage();
+
+    // enables look-ahead completion
+    ClangSettingsManager::self()->m_enableTesting = true;
+
+    QVERIFY(m_dir.isValid());
+}
+
+void BenchCodeCompletion::cleanupTestCase()
+{
+    TestCore::shutdown();
+}
+
+void BenchCodeCompletion::benchCompletionLatency_data()
+{
+    QTest::addColumn<QString>("code");
+    QTest::addColumn<bool>("needsQt");
+
+    QTest::newRow("stl") << stlSource() << false;
+    QTest::newRow("qt") << qtSource() << true;
+    QTest::newRow("big-class") << bigClassSource() << false;
+}
+
+void BenchCodeCompletion::benchCompletionLatency()
+{
+    QFETCH(QString, code);
+    QFETCH(bool, needsQt);
+
+    const auto source = makeSource(code);
+    const QString fileName = m_dir.path() + QLatin1Char('/') + QString::fromUtf8(QTest::currentDataTag()) + QStringLiteral(".cpp");
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+        file.write(source.code.toUtf8());
+    }
+
+    auto manager = IDefinesAndIncludesManager::manager();
+    ClangParsingEnvironment environment;
+    environment.setTranslationUnitUrl(IndexedString(fileName));
+    environment.addIncludes(manager->includes(fileName));
+    environment.addIncludes(manager->includesInBackground(fileName));
+    environment.addDefines(manager->defines(fileName));
+    environment.setParserSettings(ClangSettingsManager::self()->parserSettings(nullptr));
+    environment.setQuality(ClangParsingEnvironment::Source);
+    if (needsQt) {
+        const Path qtHeaders(QLibraryInfo::location(QLibraryInfo::HeadersPath));
+        if (!QFileInfo::exists(qtHeaders.toLocalFile() + QStringLiteral("/QtCore/QString"))) {
+            QSKIP("Qt headers not found");
+        }
+        environment.addIncludes({qtHeaders, Path(qtHeaders, QStringLiteral("QtCore"))});
+    }
+
+    const ParseSessionData::Ptr sessionData(new ParseSessionData({}, &m_index, environment));
+    ReferencedTopDUContext top;
+    {
+        // the session locks the translation unit, release it before completing
+        ParseSession session(sessionData);
+        QVERIFY(session.unit());
+        IncludeFileContexts includedFiles;
+        top = ClangHelpers::buildDUChain(session.mainFile(), ClangHelpers::tuImports(session.unit()), session,
+                                         TopDUContext::AllDeclarationsContextsAndUses, includedFiles);
+    }
+    QVERIFY(top);
+
+    QVector<qint64> contextTimes;
+    QVector<qint64> itemTimes;
+    QVector<qint64> helperTimes;
+    QVector<qint64> totalTimes;
+    for (const auto& position : source.positions) {
+        int items = 0;
+        for (int run = 0; run < Runs; ++run) {
+            QElapsedTimer timer;
+            timer.start();
+            // includes clang_codeCompleteAt and CompletionHelper::computeCompletions
+            CodeCompletionContext::Ptr context(new ClangCodeCompletionContext(DUContextPointer(top.data()), sessionData,
+                                                                              QUrl::fromLocalFile(fileName), position,
+                                                                              source.code));
+            const auto contextTime = timer.nsecsElapsed();
+
+            timer.restart();
+            {
+                DUChainReadLocker lock;
+                bool abort = false;
+                // includes the LookAheadItemMatcher, which is interleaved with the item creation
+                items = context->completionItems(abort).size();
+            }
+            const auto itemTime = timer.nsecsElapsed();
+
+            {
+                ParseSession session(sessionData);
+                timer.restart();
+                CompletionHelper helper;
+                helper.computeCompletions(session, session.mainFile(), position);
+                helperTimes << timer.nsecsElapsed();
+            }
+
+            contextTimes << contextTime;
+            itemTimes << itemTime;
+            totalTimes << contextTime + itemTime;
+        }
+        qDebug() << "position" << position.line() << position.column() << "items:" << items;
+    }
+
+    report("codeCompleteAt:", contextTimes);
+    report("completionItems:", itemTimes);
+    report("computeCompletions:", helperTimes);
+    report("keystroke to items:", totalTimes);
+}
+
+void BenchCodeCompletion::benchCompletionBuffer_data()
+{
+    QTest::addColumn<bool>("mirror");
+
+    QTest::newRow("copy") << false;
+    QTest::newRow("mirror") << true;
+}
+
+void BenchCodeCompletion::benchCompletionBuffer()
+{
+    QFETCH(bool, mirror);
+
+    QScopedPointer<KTextEditor::Document> document(KTextEditor::Editor::instance()->createDocument(nullptr));
+    const auto source = bigClassSource();
+    QString text;
+    for (int i = 0; i < 3; ++i) {
+        text += source;
+    }
+    document->setText(text);
+    const auto documentMirror = DocumentMirror::forDocument(document.data());
+    const KTextEditor::Cursor position(document->lines() / 2, 4);
+
+    // type at the cursor and fetch the contents passed to clang, as done on every keystroke
+    QBENCHMARK {
+        document->insertText(position, QStringLiteral("x"));
+        QByteArray contents;
+        if (mirror) {
+            contents = documentMirror->contents();
+        } else {
+            const auto before = document->text({{0, 0}, position});
+            const auto after = document->text({position, document->documentEnd()});
+            contents = (before + after).toUtf8();
+        }
+        QVERIFY(!contents.isEmpty());
+    }
+}
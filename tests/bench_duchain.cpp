@@ -0,0 +1,324 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "bench_duchain.h"
+
+#include <tests/testcore.h>
+#include <tests/autotestshell.h>
+#include <language/duchain/duchain.h>
+#include <language/duchain/duchainlock.h>
+#include <language/duchain/topducontext.h>
+
+#include "duchain/builder.h"
+#include "duchain/clanghelpers.h"
+#include "duchain/clangparsingenvironment.h"
+#include "duchain/parsesession.h"
+
+#include <QtTest>
+#include <QElapsedTimer>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace KDevelop;
+
+namespace {
+
+/// Number of heap allocations done by this process, see the replaced operator new below
+std::atomic<quint64> s_allocations{0};
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++s_allocations;
+    if (auto ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+QTEST_GUILESS_MAIN(BenchDUChain)
+
+namespace {
+
+void writeFile(const QString& fileName, const QString& contents)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+    file.write(contents.toUtf8());
+}
+
+/// thousands of classes, functions and uses
+QString manyDeclarations()
+{
+    QString code;
+    for (int i = 0; i < 2000; ++i) {
+        code += QStringLiteral("struct S%1 { int a; S%1* next; int get() const { return a; } };\n"
+                               "int func%1(const S%1& s) { return s.get() + s.a; }\n").arg(i);
+    }
+    code += QStringLiteral("int main() {\n");
+    for (int i = 0; i < 2000; ++i) {
+        code += QStringLiteral("    S%1 s%1; s%1.a = func%1(s%1);\n").arg(i);
+    }
+    code += QStringLiteral("    return 0;\n}\n");
+    return code;
+}
+
+/// deeply nested and recursive template instantiations
+QString deepTemplates()
+{
+    QString code = QStringLiteral(
+        "template<int N> struct Fib { enum { value = Fib<N - 1>::value + Fib<N - 2>::value }; };\n"
+        "template<> struct Fib<0> { enum { value = 0 }; };\n"
+        "template<> struct Fib<1> { enum { value = 1 }; };\n"
+        "template<typename T, int N> struct Nest { Nest<T, N - 1> inner; T value; T get() const { return inner.get() + value; } };\n"
+        "template<typename T> struct Nest<T, 0> { T value; T get() const { return value; } };\n"
+        "template<typename... Ts> struct List {};\n"
+        "template<typename T, typename... Ts> struct List<T, Ts...> { T head; List<Ts...> tail; };\n");
+    for (int i = 0; i < 100; ++i) {
+        code += QStringLiteral("struct T%1 {};\n"
+                               "int use%1() { Nest<int, %2> n; List<T%1, int, Nest<T%1, 3>> l; return Fib<%3>::value + n.get(); }\n")
+                    .arg(i).arg(100 + i * 2).arg(i % 40);
+    }
+    return code;
+}
+
+/// macros expanding to other macros, expanded thousands of times
+QString heavyMacros()
+{
+    QString code = QStringLiteral("#define M0(x) (x)\n");
+    for (int i = 1; i < 200; ++i) {
+        code += QStringLiteral("#define M%1(x) M%2(x) + M%2(x + %1)\n").arg(i).arg(i - 1);
+    }
+    for (int i = 0; i < 500; ++i) {
+        code += QStringLiteral("#define DECLARE%1(name) int name##%1(int x) { return M%2(x); }\n").arg(i).arg(i % 8);
+        code += QStringLiteral("DECLARE%1(function)\n").arg(i);
+    }
+    return code;
+}
+
+/// a wide include graph of guarded headers including each other
+QString wideIncludes(const QDir& dir)
+{
+    const int headers = 300;
+    for (int i = 0; i < headers; ++i) {
+        QString header = QStringLiteral("#pragma once\n");
+        for (int j = qMax(0, i - 3); j < i; ++j) {
+            header += QStringLiteral("#include \"header%1.h\"\n").arg(j);
+        }
+        header += QStringLiteral("struct Header%1 { int value; };\n"
+                                 "inline int header%1() { Header%1 h; h.value = %1; return h.value; }\n").arg(i);
+        writeFile(dir.filePath(QStringLiteral("header%1.h").arg(i)), header);
+    }
+
+    QString code;
+    for (int i = headers - 1; i >= 0; --i) {
+        code += QStringLiteral("#include \"header%1.h\"\n").arg(i);
+    }
+    code += QStringLiteral("int main() { return header0() + header%1(); }\n").arg(headers - 1);
+    return code;
+}
+
+ParseSessionData::Ptr createSessionData(const QString& fileName, ClangIndex* index)
+{
+    ClangParsingEnvironment environment;
+    environment.setTranslationUnitUrl(IndexedString(fileName));
+    environment.setQuality(ClangParsingEnvironment::Source);
+    return ParseSessionData::Ptr(new ParseSessionData({}, index, environment));
+}
+
+int countCursors(CXTranslationUnit unit)
+{
+    int cursors = 0;
+    clang_visitChildren(clang_getTranslationUnitCursor(unit), [] (CXCursor, CXCursor, CXClientData data) {
+        ++*static_cast<int*>(data);
+        return CXChildVisit_Recurse;
+    }, &cursors);
+    return cursors;
+}
+
+int countDeclarations(const DUContext* context)
+{
+    int declarations = context->localDeclarations().size();
+    foreach (auto child, context->childContexts()) {
+        declarations += countDeclarations(child);
+    }
+    return declarations;
+}
+
+}
+
+void BenchDUChain::initTestCase()
+{
+    QLoggingCategory::setFilterRules(QStringLiteral("*.debug=false\ndefault.debug=true\n"));
+    QVERIFY(qputenv("KDEV_DISABLE_PLUGINS", "kdevcppsupport"));
+    AutoTestShell::init();
+    TestCore::initialize(Core::NoUi);
+    DUChain::self()->disablePersistentStorage();
+
+    QVERIFY(m_generatedDir.isValid());
+    const QDir dir(m_generatedDir.path());
+    writeFile(dir.filePath(QStringLiteral("declarations.cpp")), manyDeclarations());
+    writeFile(dir.filePath(QStringLiteral("templates.cpp")), deepTemplates());
+    writeFile(dir.filePath(QStringLiteral("macros.cpp")), heavyMacros());
+    writeFile(dir.filePath(QStringLiteral("includes.cpp")), wideIncludes(dir));
+}
+
+void BenchDUChain::cleanupTestCase()
+{
+    TestCore::shutdown();
+}
+
+void BenchDUChain::addFiles()
+{
+    QTest::addColumn<QString>("fileName");
+
+    const QDir testFiles(QFINDTESTDATA("files"));
+    foreach (const auto& file, testFiles.entryList({QStringLiteral("*.cpp")}, QDir::Files)) {
+        QTest::newRow(qPrintable(file)) << testFiles.filePath(file);
+    }
+
+    const QDir generated(m_generatedDir.path());
+    foreach (const auto& file, generated.entryList({QStringLiteral("*.cpp")}, QDir::Files)) {
+        QTest::newRow(qPrintable(QStringLiteral("generated/") + file)) << generated.filePath(file);
+    }
+}
+
+void BenchDUChain::benchParse_data()
+{
+    addFiles();
+}
+
+void BenchDUChain::benchParse()
+{
+    QFETCH(QString, fileName);
+
+    int cursors = 0;
+    QBENCHMARK {
+        ParseSession session(createSessionData(fileName, &m_index));
+        QVERIFY(session.unit());
+        if (!cursors) {
+            cursors = countCursors(session.unit());
+        }
+    }
+
+    // measure once more outside of QBENCHMARK, to relate the time to the size of the AST
+    QElapsedTimer timer;
+    timer.start();
+    const auto allocations = s_allocations.load();
+    ParseSession session(createSessionData(fileName, &m_index));
+    const auto elapsed = timer.nsecsElapsed();
+    qDebug() << "cursors:" << cursors << "ns/cursor:" << double(elapsed) / qMax(cursors, 1)
+             << "allocations:" << s_allocations.load() - allocations;
+}
+
+void BenchDUChain::benchTuImports_data()
+{
+    addFiles();
+}
+
+void BenchDUChain::benchTuImports()
+{
+    QFETCH(QString, fileName);
+
+    ParseSession session(createSessionData(fileName, &m_index));
+    QVERIFY(session.unit());
+
+    Imports imports;
+    QBENCHMARK {
+        imports = ClangHelpers::tuImports(session.unit());
+    }
+    qDebug() << "imports:" << imports.size();
+}
+
+void BenchDUChain::benchBuilder_data()
+{
+    addFiles();
+}
+
+void BenchDUChain::benchBuilder()
+{
+    QFETCH(QString, fileName);
+
+    ParseSession session(createSessionData(fileName, &m_index));
+    QVERIFY(session.unit());
+    const auto imports = ClangHelpers::tuImports(session.unit());
+    IncludeFileContexts includedFiles;
+    const auto top = ClangHelpers::buildDUChain(session.mainFile(), imports, session,
+                                                TopDUContext::AllDeclarationsContextsAndUses, includedFiles);
+    QVERIFY(top);
+    const auto cursors = Builder::partitionCursors(session.unit());
+
+    // rebuild the declarations and uses of all files, as done when reparsing
+    Builder::Statistics statistics;
+    int runs = 0;
+    const auto allocations = s_allocations.load();
+    QBENCHMARK {
+        for (auto it = includedFiles.constBegin(); it != includedFiles.constEnd(); ++it) {
+            if (it.value()) {
+                Builder::visit(session.unit(), it.key(), cursors.value(it.key()), includedFiles, true, &statistics);
+            }
+        }
+        ++runs;
+    }
+    const auto allocationsPerRun = double(s_allocations.load() - allocations) / runs;
+
+    int declarations = 0;
+    {
+        DUChainReadLocker lock;
+        foreach (const auto& context, includedFiles) {
+            if (context) {
+                declarations += countDeclarations(context.data());
+            }
+        }
+    }
+
+    qDebug() << "cursors:" << statistics.cursors / runs << "declarations:" << declarations
+             << "uses:" << statistics.uses / runs;
+    qDebug() << "declarations ns/cursor:" << double(statistics.declarationsTime) / qMax<qint64>(statistics.cursors, 1)
+             << "uses ns/use:" << double(statistics.usesTime) / qMax<qint64>(statistics.uses, 1)
+             << "allocations/declaration:" << allocationsPerRun / qMax(declarations, 1);
+}
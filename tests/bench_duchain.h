@@ -0,0 +1,51 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef BENCH_DUCHAIN_H
+#define BENCH_DUCHAIN_H
+
+#include <QObject>
+#include <QTemporaryDir>
+
+#include "duchain/clangindex.h"
+
+class BenchDUChain : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void benchParse_data();
+    void benchParse();
+    void benchTuImports_data();
+    void benchTuImports();
+    void benchBuilder_data();
+    void benchBuilder();
+
+private:
+    /// Add a row for every JSON test file and every generated stress file
+    void addFiles();
+
+    ClangIndex m_index;
+    QTemporaryDir m_generatedDir;
+};
+
+#endif // BENCH_DUCHAIN_H
@@ -27,23 +27,32 @@
 #include <tests/autotestshell.h>
 #include <tests/testfile.h>
 
+#include "duchain/clangindex.h"
 #include "duchain/parsesession.h"
 #include "util/clangtypes.h"
 
 #include <interfaces/idocumentcontroller.h>
+#include <interfaces/ilanguagecontroller.h>
 
+#include <language/backgroundparser/backgroundparser.h>
 #include <language/codecompletion/codecompletiontesthelper.h>
 #include <language/duchain/types/functiontype.h>
 
 #include "codecompletion/completionhelper.h"
 #include "codecompletion/context.h"
+#include "codecompletion/contextcache.h"
+#include "codecompletion/documentmirror.h"
+#include "codecompletion/fuzzymatcher.h"
 #include "codecompletion/includepathcompletioncontext.h"
+#include "codecompletion/model.h"
 #include "../clangsettings/clangsettingsmanager.h"
 
 #include <KTextEditor/Editor>
 #include <KTextEditor/Document>
 #include <KTextEditor/View>
 
+#include <QTemporaryDir>
+
 #include <ktexteditor_version.h>
 #if KTEXTEDITOR_VERSION < QT_VERSION_CHECK(5, 10, 0)
 Q_DECLARE_METATYPE(KTextEditor::Cursor);
@@ -241,6 +250,50 @@ void executeMemberAccessReplacerTest(const QString& code, const CompletionItems&
     QCOMPARE(tester.names, expectedCompletionItems.completions);
 }
 
+struct CompletionSession
+{
+    DUContextPointer top;
+    ParseSessionData::Ptr data;
+};
+
+/// @return the top context of @p file and its AST, after parsing it with the AST
+CompletionSession parseForCompletion(TestFile* file)
+{
+    if (!file->parseAndWait(TopDUContext::AllDeclarationsContextsUsesAndAST)) {
+        QTest::qFail("Failed to parse source file.", __FILE__, __LINE__);
+        return {};
+    }
+
+    DUChainReadLocker lock;
+    auto top = file->topContext();
+    if (!top) {
+        QTest::qFail("Failed to parse source file.", __FILE__, __LINE__);
+        return {};
+    }
+    const ParseSessionData::Ptr sessionData(dynamic_cast<ParseSessionData*>(top->ast().data()));
+    if (!sessionData) {
+        QTest::qFail("No AST attached to the source file.", __FILE__, __LINE__);
+        return {};
+    }
+    return {DUContextPointer(top), sessionData};
+}
+
+/// @return the context to complete at @p position in @p file, without builtins and macros
+QExplicitlySharedDataPointer<ClangCodeCompletionContext> createCompletionContext(TestFile* file, const KTextEditor::Cursor& position)
+{
+    const auto session = parseForCompletion(file);
+    if (!session.data) {
+        return {};
+    }
+
+    QExplicitlySharedDataPointer<ClangCodeCompletionContext> context(
+        new ClangCodeCompletionContext(session.top, session.data, file->url().toUrl(), position, QString()));
+    context->setFilters(ClangCodeCompletionContext::ContextFilters(
+                            ClangCodeCompletionContext::NoBuiltins |
+                            ClangCodeCompletionContext::NoMacros));
+    return context;
+}
+
 using IncludeTester = CodeCompletionItemTester<IncludePathCompletionContext>;
 
 QExplicitlySharedDataPointer<IncludePathCompletionContext> executeIncludePathCompletion(TestFile* file, const KTextEditor::Cursor& position)
@@ -899,6 +952,33 @@ void TestCodeCompletion::testCompletionPriority_data()
         << CompletionPriorityItems{{1,0}, {{"m_protected", 0, 37}}};
 }
 
+void TestCodeCompletion::testOverloadedFunctionsStreamed()
+{
+    // the expected type gives the overloads different priorities, and streamed items are created best first
+    TestFile file("void f(); int f(int); void f(int, double){\n int i = ", "cpp");
+    auto context = createCompletionContext(&file, {1, 9});
+    QVERIFY(context);
+    context->setItemsReadyCallback([] (const QList<CompletionTreeItemPointer>&) {
+        return true;
+    });
+
+    DUChainReadLocker lock;
+    const auto tester = ClangCodeCompletionItemTester(context);
+    QSet<Declaration*> overloads;
+    for (const auto& item : tester.items) {
+        if (!item->declaration() || item->declaration()->identifier().toString() != QLatin1String("f")) {
+            continue;
+        }
+        auto function = item->declaration()->type<FunctionType>();
+        QVERIFY(function);
+        const QString display = item->declaration()->identifier().toString() + function->partToString(FunctionType::SignatureArguments);
+        const QString itemDisplay = tester.itemData(item).toString() + tester.itemData(item, KTextEditor:: CodeCompletionModel::Arguments).toString();
+        QCOMPARE(display, itemDisplay);
+        overloads.insert(item->declaration().data());
+    }
+    QCOMPARE(overloads.size(), 3);
+}
+
 void TestCodeCompletion::testVariableScope()
 {
     TestFile file("int var; \nvoid test(int var) {int tmp =\n }", "cpp");
@@ -924,3 +1004,334 @@ void TestCodeCompletion::testVariableScope()
     VERIFY(item);
     QCOMPARE(item->declaration()->range().start, CursorInRevision(1, 14));
 }
+
+void TestCodeCompletion::testDocumentMirror()
+{
+    auto document = KTextEditor::Editor::instance()->createDocument(this);
+    document->setText(QStringLiteral("int main() {\n    return 0;\n}\n"));
+
+    auto mirror = DocumentMirror::forDocument(document);
+    QCOMPARE(DocumentMirror::forDocument(document), mirror);
+    QCOMPARE(mirror->contents(), document->text().toUtf8());
+
+    document->insertText({1, 4}, QStringLiteral("int \u00e4 = 1;\n    "));
+    QCOMPARE(mirror->contents(), document->text().toUtf8());
+    document->insertText({0, 0}, QStringLiteral("// \u00f6\u00df\u20ac\n"));
+    QCOMPARE(mirror->contents(), document->text().toUtf8());
+    document->removeText({1, 2, 2, 8});
+    QCOMPARE(mirror->contents(), document->text().toUtf8());
+    document->replaceText({0, 3, 0, 5}, QStringLiteral("\u00fc"));
+    QCOMPARE(mirror->contents(), document->text().toUtf8());
+    document->removeLine(1);
+    QCOMPARE(mirror->contents(), document->text().toUtf8());
+    document->setText(QStringLiteral("void foo();"));
+    QCOMPARE(mirror->contents(), document->text().toUtf8());
+
+    delete document;
+}
+
+void TestCodeCompletion::testFuzzyMatcher()
+{
+    QVERIFY(FuzzyMatcher().isEmpty());
+    QVERIFY(FuzzyMatcher().matches(QByteArray("anything")));
+
+    const FuzzyMatcher matcher(QStringLiteral("fB"));
+    QVERIFY(!matcher.isEmpty());
+    QVERIFY(matcher.matches(QByteArray("fooBar")));
+    QVERIFY(matcher.matches(QByteArray("FB")));
+    QVERIFY(matcher.matches(QByteArray("xfxbx")));
+    QVERIFY(!matcher.matches(QByteArray("bf")));
+    QVERIFY(!matcher.matches(QByteArray("foo")));
+    QVERIFY(!matcher.matches(QByteArray()));
+
+    const FuzzyMatcher unicodeMatcher(QStringLiteral("\u00e4x"));
+    QVERIFY(unicodeMatcher.matches(QStringLiteral("a\u00e4bx").toUtf8()));
+    QVERIFY(!unicodeMatcher.matches(QByteArray("ax")));
+
+    // long enough to be scanned in chunks
+    const QByteArray padding(40, 'x');
+    const FuzzyMatcher longMatcher(QStringLiteral("foo"));
+    QVERIFY(longMatcher.matches(padding + "Foo" + padding));
+    QVERIFY(longMatcher.matches(padding + "f" + padding + "O" + padding + "o"));
+    QVERIFY(!longMatcher.matches(padding + "fo" + padding));
+}
+
+void TestCodeCompletion::testFuzzyMatcherScore()
+{
+    const FuzzyMatcher matcher(QStringLiteral("foo"));
+    QCOMPARE(matcher.score(QByteArray("bar")), -1);
+    QCOMPARE(matcher.score(QByteArray("fo")), -1);
+    QVERIFY(matcher.score(QByteArray("foo")) > matcher.score(QByteArray("fooBar")));
+    QVERIFY(matcher.score(QByteArray("fooBar")) > matcher.score(QByteArray("afoo")));
+    QVERIFY(matcher.score(QByteArray("foo")) > matcher.score(QByteArray("Foo")));
+    QVERIFY(matcher.score(QByteArray("Foo")) >= 0);
+
+    const FuzzyMatcher camelCaseMatcher(QStringLiteral("fB"));
+    QVERIFY(camelCaseMatcher.score(QByteArray("fooBar")) > camelCaseMatcher.score(QByteArray("fab")));
+    QVERIFY(camelCaseMatcher.score(QByteArray("foo_bar")) > camelCaseMatcher.score(QByteArray("foobar")));
+
+    QVERIFY(FuzzyMatcher().score(QByteArray("anything")) >= 0);
+}
+
+void TestCodeCompletion::testFilterPrefix()
+{
+    TestFile file("struct S { int fooBar; int foo; int baz; };\nvoid f(S s) { s.\n }", "cpp");
+    auto context = createCompletionContext(&file, {1, 16});
+    QVERIFY(context);
+
+    // the same context gets reused while typing the identifier
+    DUChainReadLocker lock;
+    context->setFilterPrefix(QStringLiteral("fB"));
+    const auto camelCaseTester = ClangCodeCompletionItemTester(context);
+    QCOMPARE(camelCaseTester.names, QStringList{QStringLiteral("fooBar")});
+
+    context->setFilterPrefix(QStringLiteral("fo"));
+    auto prefixTester = ClangCodeCompletionItemTester(context);
+    prefixTester.names.sort();
+    QCOMPARE(prefixTester.names, QStringList({QStringLiteral("foo"), QStringLiteral("fooBar")}));
+
+    context->setFilterPrefix({});
+    const auto unfilteredTester = ClangCodeCompletionItemTester(context);
+    QVERIFY(unfilteredTester.names.contains(QStringLiteral("baz")));
+}
+
+void TestCodeCompletion::testContextCache()
+{
+    const QByteArray declarations = "struct S { int foo; S* next; static int bar; };\n";
+    const QByteArray line = "void f(S s) { s.";
+    TestFile file(QString::fromUtf8(declarations + line + "\n }"), QStringLiteral("cpp"));
+    const auto session = parseForCompletion(&file);
+    QVERIFY(session.data);
+
+    // the completion request at the end of @p text, in the document with @p text in the second line
+    const KTextEditor::Cursor position(1, line.size());
+    const auto key = [&] (const QByteArray& text, const KTextEditor::Cursor& at) {
+        return CompletionContextKey(session.top, session.data, file.url().toUrl(), at,
+                                    QString::fromUtf8(text.left(at.column())), declarations + text + "\n }");
+    };
+    const auto original = key(line, position);
+    const auto typed = key(line + "fo", position);
+
+    QVERIFY(original.equalsOutsideIdentifier(typed.contents, typed.identifierStart, typed.identifierEnd));
+    QVERIFY(typed.equalsOutsideIdentifier(original.contents, original.identifierStart, original.identifierEnd));
+    const auto editedBefore = key("void g(S s) { s.fo", position);
+    QVERIFY(!original.equalsOutsideIdentifier(editedBefore.contents, editedBefore.identifierStart, editedBefore.identifierEnd));
+
+    CompletionContextCache cache;
+    QVERIFY(!cache.find(original));
+    const auto context = QSharedPointer<ClangCodeCompletionContext>::create(session.top, session.data, file.url().toUrl(),
+                                                                            position, original.contents);
+    cache.insert(original, context);
+
+    // reused while typing the identifier
+    QCOMPARE(cache.find(original), context);
+    QCOMPARE(cache.find(typed), context);
+
+    // member access and scope operators start a new completion
+    QVERIFY(!cache.find(key(line + "next.", {1, line.size() + 5})));
+    QVERIFY(!cache.find(key(line + "next->", {1, line.size() + 6})));
+    QVERIFY(!cache.find(key("void f(S s) { S::", {1, 17})));
+    // also when typed behind the identifier at the same position
+    QVERIFY(!cache.find(key(line + "next.", position)));
+    QVERIFY(!cache.find(key(line + "next->", position)));
+    QVERIFY(!cache.find(key(line + "S::", position)));
+
+    // edits outside of the identifier
+    QVERIFY(!cache.find(editedBefore));
+    QVERIFY(!cache.find(key(line + "fo + 1", position)));
+
+    // and parsing the translation unit again
+    {
+        ParseSession parseSession(session.data);
+        QVERIFY(parseSession.reparse({}, parseSession.environment()));
+    }
+    QVERIFY(!cache.find(key(line + "fo", position)));
+}
+
+void TestCodeCompletion::testStreamedItems()
+{
+    QByteArray code = "struct S {";
+    for (int i = 0; i < 300; ++i) {
+        code += " int member" + QByteArray::number(i) + ';';
+    }
+    code += " };\nvoid f(S s) { s.\n }";
+    TestFile file(code, "cpp");
+    auto context = createCompletionContext(&file, {1, 16});
+    QVERIFY(context);
+
+    QList<QList<CompletionTreeItemPointer>> batches;
+    context->setItemsReadyCallback([&batches] (const QList<CompletionTreeItemPointer>& items) {
+        batches.append(items);
+        return true;
+    });
+
+    DUChainReadLocker lock;
+    bool abort = false;
+    const auto items = context->completionItems(abort);
+    QVERIFY(items.size() >= 300);
+    // reported after 100 and 200 results
+    QCOMPARE(batches.size(), 2);
+    QVERIFY(!batches.first().isEmpty());
+    for (const auto& batch : batches) {
+        QVERIFY(batch.size() < items.size());
+        QCOMPARE(batch, items.mid(0, batch.size()));
+    }
+
+    // aborting from the callback stops creating items
+    context->setItemsReadyCallback([] (const QList<CompletionTreeItemPointer>&) {
+        return false;
+    });
+    QVERIFY(context->completionItems(abort).isEmpty());
+}
+
+void TestCodeCompletion::testParallelItems()
+{
+    // enough results to create their items concurrently
+    QByteArray code = "struct S { void foo(int); void foo(double); void foo(char);";
+    for (int i = 0; i < 1200; ++i) {
+        code += " int member" + QByteArray::number(i) + ';';
+    }
+    code += " };\nvoid f(S s) { s.\n }";
+    TestFile file(code, "cpp");
+    auto context = createCompletionContext(&file, {1, 16});
+    QVERIFY(context);
+
+    DUChainReadLocker lock;
+    bool abort = false;
+    const auto items = context->completionItems(abort);
+    QVERIFY(items.size() >= 1203);
+
+    // each overload gets its own declaration
+    QSet<Declaration*> overloads;
+    for (const auto& item : items) {
+        if (item->declaration() && item->declaration()->identifier().toString() == QLatin1String("foo")) {
+            overloads.insert(item->declaration().data());
+        }
+    }
+    QCOMPARE(overloads.size(), 3);
+
+    // the concurrently created items equal the ones created in a single thread, in the same order
+    context->setMaximumThreadCount(1);
+    const auto singleThreadItems = context->completionItems(abort);
+    QCOMPARE(singleThreadItems.size(), items.size());
+    for (int i = 0; i < items.size(); ++i) {
+        QCOMPARE(items[i]->declaration().data(), singleThreadItems[i]->declaration().data());
+    }
+}
+
+void TestCodeCompletion::testFilterPrefixRanking()
+{
+    TestFile file("struct S { int afoo; int fooBar; int foo; int xfxoxo; };\nvoid f(S s) { s.\n }", "cpp");
+    auto context = createCompletionContext(&file, {1, 16});
+    QVERIFY(context);
+
+    DUChainReadLocker lock;
+    context->setFilterPrefix(QStringLiteral("foo"));
+    auto tester = ClangCodeCompletionItemTester(context);
+    QCOMPARE(tester.names, QStringList({QStringLiteral("foo"), QStringLiteral("fooBar"),
+                                        QStringLiteral("afoo"), QStringLiteral("xfxoxo")}));
+
+    // the rank is the match quality of the items
+    const auto matchQuality = [&tester] (const QString& name) {
+        const auto item = tester.findItem(name);
+        return item ? tester.itemData(item, KTextEditor::CodeCompletionModel::Name,
+                                      KTextEditor::CodeCompletionModel::MatchQuality).toInt() : -1;
+    };
+    QVERIFY(matchQuality(QStringLiteral("foo")) > matchQuality(QStringLiteral("fooBar")));
+    QVERIFY(matchQuality(QStringLiteral("fooBar")) > matchQuality(QStringLiteral("afoo")));
+    QVERIFY(matchQuality(QStringLiteral("afoo")) > matchQuality(QStringLiteral("xfxoxo")));
+    QVERIFY(matchQuality(QStringLiteral("xfxoxo")) >= 0);
+    lock.unlock();
+
+    // only the best ranked results of long prefixes get items, the editor filters them further while typing
+    QByteArray code = "struct T {";
+    for (int i = 0; i < 600; ++i) {
+        code += " int member" + QByteArray::number(i) + ';';
+    }
+    code += " };\nvoid g(T t) { t.\n }";
+    TestFile manyMembers(code, "cpp");
+    auto manyContext = createCompletionContext(&manyMembers, {1, 16});
+    QVERIFY(manyContext);
+
+    lock.lock();
+    manyContext->setFilterPrefix(QStringLiteral("m"));
+    QVERIFY(ClangCodeCompletionItemTester(manyContext).names.size() >= 600);
+    manyContext->setFilterPrefix(QStringLiteral("mem"));
+    QVERIFY(ClangCodeCompletionItemTester(manyContext).names.size() <= 500);
+}
+
+void TestCodeCompletion::testParsePriorities()
+{
+    QTemporaryDir dir;
+    const auto url = [&dir] (const QString& name) {
+        return IndexedString(QUrl::fromLocalFile(dir.path() + QLatin1Char('/') + name));
+    };
+    foreach (const auto& name, {QStringLiteral("a.cpp"), QStringLiteral("a.h"), QStringLiteral("a.hpp"), QStringLiteral("b.cpp")}) {
+        QFile file(url(name).str());
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+    }
+
+    auto parser = ICore::self()->languageController()->backgroundParser();
+    auto documents = ICore::self()->documentController();
+    parser->suspend();
+    auto activeDocument = documents->openDocument(url(QStringLiteral("a.cpp")).toUrl());
+    QVERIFY(activeDocument);
+    QVERIFY(documents->openDocument(url(QStringLiteral("a.h")).toUrl()));
+    QVERIFY(documents->openDocument(url(QStringLiteral("b.cpp")).toUrl()));
+
+    documents->activateDocument(activeDocument);
+    // the active document first, then its open buddy, then the other open documents
+    QTRY_COMPARE(parser->priorityForDocument(url(QStringLiteral("a.cpp"))), int(BackgroundParser::BestPriority));
+    QVERIFY(parser->priorityForDocument(url(QStringLiteral("a.h"))) > parser->priorityForDocument(url(QStringLiteral("a.cpp"))));
+    QVERIFY(parser->priorityForDocument(url(QStringLiteral("b.cpp"))) > parser->priorityForDocument(url(QStringLiteral("a.h"))));
+    // buddies which are not queued already don't get parsed
+    QVERIFY(!parser->isQueued(url(QStringLiteral("a.hpp"))));
+
+    documents->closeAllDocuments();
+    parser->resume();
+}
+
+void TestCodeCompletion::testReparseOnCompletionMiss()
+{
+    TestFile file(QStringLiteral("struct S { int member; };\nvoid f(S s) { s.\n }"), QStringLiteral("cpp"));
+    auto parser = ICore::self()->languageController()->backgroundParser();
+    auto documents = ICore::self()->documentController();
+    auto document = documents->openDocument(file.url().toUrl());
+    QVERIFY(document);
+    documents->activateDocument(document);
+    auto view = documents->activeTextDocumentView();
+    QVERIFY(view);
+    const KTextEditor::Cursor position(1, 16);
+    view->setCursorPosition(position);
+
+    QVERIFY(file.parseAndWait(TopDUContext::AllDeclarationsContextsUsesAndAST));
+    QTRY_VERIFY(!parser->isQueued(file.url()));
+    parser->suspend();
+    {
+        // drop the AST, the completion misses then
+        DUChainWriteLocker lock;
+        QVERIFY(file.topContext());
+        file.topContext()->setAst({});
+    }
+
+    ClangIndex index;
+    ClangCodeCompletionModel model(&index);
+    model.initialize();
+
+    // the miss schedules an urgent reparse
+    model.completionInvoked(view, {position, position}, KTextEditor::CodeCompletionModel::ManualInvocation);
+    QTRY_VERIFY(parser->isQueued(file.url()));
+    QCOMPARE(parser->priorityForDocument(file.url()), int(BackgroundParser::BestPriority));
+
+    // a reparse that got dropped never reports back, the next miss schedules it again
+    parser->removeDocument(file.url(), &model);
+    QVERIFY(!parser->isQueued(file.url()));
+    model.completionInvoked(view, {position, position}, KTextEditor::CodeCompletionModel::ManualInvocation);
+    QTRY_VERIFY(parser->isQueued(file.url()));
+
+    // once the reparse landed, the completion is re-issued in the view
+    parser->resume();
+    QTRY_VERIFY(model.rowCount() > 0);
+
+    document->close(IDocument::Silent);
+}
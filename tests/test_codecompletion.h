@@ -50,7 +50,18 @@ private slots:
     void testReplaceMemberAccess_data();
 
     void testOverloadedFunctions();
+    void testOverloadedFunctionsStreamed();
     void testVariableScope();
+    void testDocumentMirror();
+    void testFuzzyMatcher();
+    void testFuzzyMatcherScore();
+    void testFilterPrefix();
+    void testContextCache();
+    void testFilterPrefixRanking();
+    void testStreamedItems();
+    void testParallelItems();
+    void testParsePriorities();
+    void testReparseOnCompletionMiss();
 };
 
 #endif // TESTCODECOMPLETION_H
@@ -25,6 +25,7 @@
 #include <tests/testcore.h>
 #include <tests/autotestshell.h>
 #include <tests/testfile.h>
+#include <tests/testproject.h>
 #include <language/duchain/duchainlock.h>
 #include <language/duchain/duchain.h>
 #include <language/duchain/declaration.h>
@@ -38,15 +39,24 @@
 #include <language/duchain/functiondefinition.h>
 #include <language/backgroundparser/backgroundparser.h>
 #include <interfaces/ilanguagecontroller.h>
+#include <interfaces/isession.h>
 #include <util/kdevstringhandler.h>
 
 #include "duchain/clangparsingenvironmentfile.h"
 #include "duchain/clangparsingenvironment.h"
 #include "duchain/parsesession.h"
+#include "duchain/clanghelpers.h"
+#include "duchain/clangindex.h"
+#include "duchain/clangpch.h"
+#include "indexer/clangindexer.h"
+#include "clangenvironmentcache.h"
 
 #include <custom-definesandincludes/idefinesandincludesmanager.h>
 
+#include <KConfigGroup>
 #include <QtTest>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
 
 QTEST_GUILESS_MAIN(TestDUChain);
 
@@ -61,9 +71,9 @@ public:
         return defines;
     }
 
-    virtual Path::List includesInBackground(const QString& /*path*/) const override
+    virtual Path::List includesInBackground(const QString& path) const override
     {
-        return includes;
+        return includes + fileIncludes.value(path);
     }
 
     virtual IDefinesAndIncludesManager::Type type() const override
@@ -73,6 +83,8 @@ public:
 
     QHash<QString, QString> defines;
     Path::List includes;
+    /// additional includes by the path of the file
+    QHash<QString, Path::List> fileIncludes;
 };
 
 TestDUChain::~TestDUChain() = default;
@@ -82,8 +94,10 @@ void TestDUChain::initTestCase()
     QLoggingCategory::setFilterRules(QStringLiteral("*.debug=false\ndefault.debug=true\nkdevelop.plugins.clang.debug=true\n"));
     QVERIFY(qputenv("KDEV_DISABLE_PLUGINS", "kdevcppsupport"));
     AutoTestShell::init();
-    TestCore::initialize(Core::NoUi);
-
+    auto core = TestCore::initialize(Core::NoUi);
+    delete core->projectController();
+    m_projectController = new TestProjectController(core);
+    core->setProjectController(m_projectController);
 }
 
 void TestDUChain::cleanupTestCase()
@@ -749,6 +763,156 @@ void TestDUChain::testSystemIncludes()
     includes = env.includes();
     QCOMPARE(includes.system, systemIncludes);
     QCOMPARE(includes.project, projectIncludes);
+
+    // includes added afterwards get classified too, by whole path segments
+    Path::List moreIncludes = {
+        Path("/projects/10"),
+        Path("/projects/2/sub/subsub"),
+        Path("/projects")
+    };
+    env.addIncludes(moreIncludes);
+    includes = env.includes();
+    QCOMPARE(includes.system, systemIncludes + Path::List{Path("/projects/10"), Path("/projects")});
+    QCOMPARE(includes.project, projectIncludes + Path::List{Path("/projects/2/sub/subsub")});
+
+    // copies keep the classification
+    const ClangParsingEnvironment copy = env;
+    QCOMPARE(copy.includes().project, includes.project);
+    QCOMPARE(copy.includes().system, includes.system);
+}
+
+void TestDUChain::testIndexerResultReused()
+{
+    TestFile header("#pragma once\nstruct Header { int member; };\n", "h");
+    TestFile impl("#include \"" + header.url().byteArray() + "\"\n"
+                  "int main() { return Header().member; }\n", "cpp");
+
+    // build the DUChain like kdev-clang-indexer does
+    ClangIndex index;
+    ClangEnvironmentCache environmentCache;
+    QString projectName;
+    const auto environment = environmentCache.environment(index.translationUnitForUrl(impl.url()), &projectName);
+    const auto indexed = ClangIndexer::indexTranslationUnit(&index, &environmentCache, environment,
+                                                            TopDUContext::AllDeclarationsContextsAndUses);
+    QVERIFY(indexed);
+    {
+        // gets cleared by a rebuild
+        DUChainWriteLocker lock;
+        ProblemPointer marker(new Problem);
+        marker->setDescription(QStringLiteral("marker"));
+        indexed->setProblems({marker});
+    }
+
+    // the parse job of the IDE finds the indexed context up to date
+    QVERIFY(impl.parseAndWait(TopDUContext::AllDeclarationsContextsAndUses));
+    DUChainReadLocker lock;
+    QCOMPARE(impl.topContext().data(), indexed.data());
+    QCOMPARE(indexed->problems().size(), 1);
+}
+
+void TestDUChain::testEnvironmentCacheInvalidation()
+{
+    QTemporaryDir dir;
+    QVERIFY(QDir(dir.path()).mkdir(QStringLiteral("sub")));
+    const auto writePchInclude = [] (const QString& directory, const Path& header) {
+        QFile file(directory + QLatin1String("/.kdev_pch_include"));
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text));
+        file.write(header.toLocalFile().toLocal8Bit() + '\n');
+    };
+
+    ClangEnvironmentCache cache;
+    const auto pchInclude = [&cache, &dir] {
+        ClangParsingEnvironment environment;
+        environment.setTranslationUnitUrl(IndexedString(dir.path() + QLatin1String("/sub/tu.cpp")));
+        cache.addBackgroundEnvironment(&environment);
+        return environment.pchInclude();
+    };
+
+    const Path headerA(dir.path() + QLatin1String("/a.h"));
+    const Path headerB(dir.path() + QLatin1String("/b.h"));
+    const Path headerC(dir.path() + QLatin1String("/c.h"));
+    writePchInclude(dir.path(), headerA);
+    QCOMPARE(pchInclude(), headerA);
+
+    // the PCH include file of a parent directory changes
+    writePchInclude(dir.path(), headerB);
+    QTRY_COMPARE(pchInclude(), headerB);
+
+    // one closer to the translation unit gets created
+    writePchInclude(dir.path() + QLatin1String("/sub"), headerC);
+    QTRY_COMPARE(pchInclude(), headerC);
+
+    // and removed again
+    QVERIFY(QFile::remove(dir.path() + QLatin1String("/sub/.kdev_pch_include")));
+    QTRY_COMPARE(pchInclude(), headerB);
+
+    const auto includes = [&cache, &dir] (const QString& tu) {
+        ClangParsingEnvironment environment;
+        environment.setTranslationUnitUrl(IndexedString(dir.path() + QLatin1String("/sub/") + tu));
+        cache.addBackgroundEnvironment(&environment);
+        return environment.includes().system;
+    };
+
+    // the background providers answer per file, not per directory
+    const auto tu2 = dir.path() + QLatin1String("/sub/tu2.cpp");
+    m_provider->fileIncludes.insert(tu2, {headerA.parent()});
+    QCOMPARE(includes(QStringLiteral("tu.cpp")), Path::List());
+    QCOMPARE(includes(QStringLiteral("tu2.cpp")), Path::List{headerA.parent()});
+
+    // providers may read the custom include paths, their changes drop the cached results
+    const Path includeDir(dir.path() + QLatin1String("/include"));
+    m_provider->includes = {includeDir};
+    QCOMPARE(includes(QStringLiteral("tu.cpp")), Path::List());
+    {
+        QFile file(dir.path() + QLatin1String("/.kdev_include_paths"));
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text));
+        file.write(includeDir.toLocalFile().toLocal8Bit() + '\n');
+    }
+    QTRY_COMPARE(includes(QStringLiteral("tu.cpp")), Path::List{includeDir});
+}
+
+void TestDUChain::testTwoTierIndexing()
+{
+    auto settings = ICore::self()->activeSession()->config()->group("Clang Settings");
+    settings.writeEntry("twoTierIndexing", true);
+
+    auto project = new TestProject(Path(QDir::tempPath()));
+    m_projectController->addProject(project);
+    TestFile file("int foo() { return 1; }\nint bar() { return foo(); }\n", "cpp", project);
+
+    const auto fooUses = [&file] {
+        DUChainReadLocker lock;
+        auto top = DUChainUtils::standardContextForUrl(file.url().toUrl());
+        if (!top) {
+            return -1;
+        }
+        const auto declarations = top->findDeclarations(QualifiedIdentifier(QStringLiteral("foo")));
+        return declarations.isEmpty() ? -1 : declarations.first()->uses().value(file.url()).size();
+    };
+
+    // the project import only indexes the declarations
+    QVERIFY(file.parseAndWait(TopDUContext::AllDeclarationsContextsAndUses, BackgroundParser::InitialParsePriority));
+    QCOMPARE(fooUses(), 0);
+
+    // an upgrade that got removed from the background parser before it ran is queued again
+    auto parser = ICore::self()->languageController()->backgroundParser();
+    parser->suspend();
+    QTRY_VERIFY(parser->isQueued(file.url()));
+    parser->removeDocument(file.url());
+    QVERIFY(!parser->isQueued(file.url()));
+    QTRY_VERIFY(parser->isQueued(file.url()));
+    parser->resume();
+
+    // the ClangIndexUpgrader adds the uses once the background parser is idle
+    QTRY_COMPARE(fooUses(), 1);
+
+    // reparsing the entire project is not the initial import, its uses are indexed right away
+    QVERIFY(file.parseAndWait(static_cast<TopDUContext::Features>(TopDUContext::AllDeclarationsContextsAndUses | TopDUContext::ForceUpdate),
+                              BackgroundParser::InitialParsePriority));
+    QCOMPARE(fooUses(), 1);
+
+    settings.writeEntry("twoTierIndexing", false);
+    m_projectController->closeAllProjects();
 }
 
 void TestDUChain::benchDUChainBuilder()
@@ -1107,3 +1271,425 @@ void TestDUChain::testRangesOfOperatorsInsideMacro()
     QCOMPARE(operatorPlusPlus->uses().size(), 1);
     QCOMPARE(operatorPlusPlus->uses().begin()->first(), RangeInRevision(3,10,3,10));
 }
+
+namespace {
+
+QString rangeString(const RangeInRevision& range)
+{
+    return QStringLiteral("[(%1, %2), (%3, %4)]").arg(range.start.line).arg(range.start.column)
+                                                .arg(range.end.line).arg(range.end.column);
+}
+
+/// Serializes the declarations, contexts, uses and imports of @p context
+QString dumpContext(const DUContext* context, int depth = 0)
+{
+    const QString indent(depth * 2, QLatin1Char(' '));
+    QString dump = indent + QString::number(context->type()) + QLatin1Char(' ')
+                 + context->localScopeIdentifier().toString() + QLatin1Char(' ')
+                 + rangeString(context->range()) + QLatin1Char('\n');
+
+    foreach (const auto& import, context->importedParentContexts()) {
+        auto imported = import.context(context->topContext());
+        dump += indent + QStringLiteral("import ") + (imported ? imported->url().str() : QString())
+              + QLatin1Char(' ') + QString::number(import.position.line) + QLatin1Char('\n');
+    }
+    foreach (auto decl, context->localDeclarations()) {
+        dump += indent + QStringLiteral("decl ") + decl->toString() + QLatin1Char(' ')
+              + rangeString(decl->range()) + QLatin1Char('\n');
+    }
+    for (int i = 0; i < context->usesCount(); ++i) {
+        const auto& use = context->uses()[i];
+        auto used = use.usedDeclaration(context->topContext());
+        dump += indent + QStringLiteral("use ") + (used ? used->qualifiedIdentifier().toString() : QString())
+              + QLatin1Char(' ') + rangeString(use.m_range) + QLatin1Char('\n');
+    }
+    foreach (auto child, context->childContexts()) {
+        dump += dumpContext(child, depth + 1);
+    }
+    return dump;
+}
+
+}
+
+void TestDUChain::testParallelBuilder()
+{
+    TestFile base("#pragma once\nstruct Base { int member; };\nint baseFunc(Base* b);\n", "h");
+    TestFile left("#pragma once\n#include \"" + base.url().byteArray() + "\"\n"
+                  "struct Left : Base { void left(); };\n", "h");
+    TestFile right("#pragma once\n#include \"" + base.url().byteArray() + "\"\n"
+                   "namespace NS { Base right(int arg); }\n", "h");
+    TestFile impl("#include \"" + left.url().byteArray() + "\"\n"
+                  "#include \"" + right.url().byteArray() + "\"\n"
+                  "int main() { Left l; l.left(); return baseFunc(&l) + NS::right(l.member).member; }\n", "cpp");
+
+    ClangIndex index;
+    ClangParsingEnvironment environment;
+    environment.setTranslationUnitUrl(impl.url());
+    ParseSession session(ParseSessionData::Ptr(new ParseSessionData({}, &index, environment)));
+    QVERIFY(session.unit());
+    const auto imports = ClangHelpers::tuImports(session.unit());
+
+    // the first run creates the contexts, the following ones update them serially and in parallel
+    const int threads[] = {1, 1, 4};
+    QMap<QString, QString> dumps[3];
+    for (int i = 0; i < 3; ++i) {
+        const auto features = static_cast<TopDUContext::Features>(TopDUContext::AllDeclarationsContextsAndUses | TopDUContext::ForceUpdate);
+        IncludeFileContexts includedFiles;
+        auto top = ClangHelpers::buildDUChain(session.mainFile(), imports, session, features,
+                                              includedFiles, &index, threads[i]);
+        QVERIFY(top);
+
+        DUChainReadLocker lock;
+        QCOMPARE(includedFiles.size(), 4);
+        foreach (const auto& context, includedFiles) {
+            QVERIFY(context);
+            dumps[i].insert(context->url().str(), dumpContext(context.data()));
+        }
+    }
+
+    QVERIFY(dumps[0].value(impl.url().str()).contains(QStringLiteral("use NS::right")));
+    QCOMPARE(dumps[2], dumps[1]);
+}
+
+void TestDUChain::testTouchedHeaderNotRebuilt()
+{
+    const QString headerContents = QStringLiteral("#pragma once\nstruct Header { int member; };\n");
+    TestFile header(headerContents, "h");
+    TestFile impl("#include \"" + header.url().byteArray() + "\"\n"
+                  "int main() { return Header().member; }\n", "cpp");
+
+    ClangIndex index;
+    ClangParsingEnvironment environment;
+    environment.setTranslationUnitUrl(impl.url());
+
+    auto build = [&] (const QVector<UnsavedFile>& unsavedFiles) -> ReferencedTopDUContext {
+        ParseSession session(ParseSessionData::Ptr(new ParseSessionData(unsavedFiles, &index, environment)));
+        IncludeFileContexts includedFiles;
+        ClangHelpers::buildDUChain(session.mainFile(), ClangHelpers::tuImports(session.unit()), session,
+                                   TopDUContext::AllDeclarationsContextsAndUses, includedFiles, &index);
+        DUChainReadLocker lock;
+        return DUChain::self()->chainForDocument(header.url());
+    };
+
+    // fakes an older modification time and marks the context, which gets cleared by a rebuild
+    auto touch = [&] (const ReferencedTopDUContext& context) {
+        DUChainWriteLocker lock;
+        auto envFile = context->parsingEnvironmentFile();
+        const auto revision = envFile->modificationRevision();
+        envFile->setModificationRevision(ModificationRevision(QDateTime::fromTime_t(revision.modificationTime - 60), revision.revision));
+        ProblemPointer marker(new Problem);
+        marker->setDescription(QStringLiteral("marker"));
+        context->setProblems({marker});
+    };
+
+    auto headerCtx = build({});
+    QVERIFY(headerCtx);
+    touch(headerCtx);
+
+    // same content, the context is kept as-is
+    header.setFileContents(headerContents);
+    QCOMPARE(build({}).data(), headerCtx.data());
+    {
+        DUChainReadLocker lock;
+        QCOMPARE(headerCtx->problems().size(), 1);
+        QVERIFY(!headerCtx->parsingEnvironmentFile()->needsUpdate());
+    }
+
+    // changed content, the context gets rebuilt
+    touch(headerCtx);
+    header.setFileContents(headerContents + QStringLiteral("int foo();\n"));
+    QCOMPARE(build({}).data(), headerCtx.data());
+    {
+        DUChainReadLocker lock;
+        QCOMPARE(headerCtx->problems().size(), 0);
+        QCOMPARE(headerCtx->localDeclarations().size(), 2);
+    }
+
+    // parsed from unsaved contents, the fingerprint of the content on disk must not be kept
+    touch(headerCtx);
+    build({UnsavedFile(header.url().str(), {headerContents + QStringLiteral("int bar();\nint baz();\n")})});
+    {
+        DUChainReadLocker lock;
+        QCOMPARE(headerCtx->localDeclarations().size(), 3);
+    }
+    touch(headerCtx);
+    QCOMPARE(build({}).data(), headerCtx.data());
+    {
+        DUChainReadLocker lock;
+        QCOMPARE(headerCtx->problems().size(), 0);
+        QCOMPARE(headerCtx->localDeclarations().size(), 2);
+    }
+
+    // changed on disk between the parse and the build, the fingerprint is the one of the parsed content
+    touch(headerCtx);
+    header.setFileContents(headerContents + QStringLiteral("int bar();\n"));
+    {
+        ParseSession session(ParseSessionData::Ptr(new ParseSessionData({}, &index, environment)));
+        header.setFileContents(headerContents);
+        IncludeFileContexts includedFiles;
+        ClangHelpers::buildDUChain(session.mainFile(), ClangHelpers::tuImports(session.unit()), session,
+                                   TopDUContext::AllDeclarationsContextsAndUses, includedFiles, &index);
+    }
+    touch(headerCtx);
+    QCOMPARE(build({}).data(), headerCtx.data());
+    {
+        DUChainReadLocker lock;
+        QCOMPARE(headerCtx->localDeclarations().size(), 1);
+    }
+}
+
+void TestDUChain::testSharedDefinesFile()
+{
+    ClangIndex index;
+    ClangParsingEnvironment environment;
+    environment.addDefines({{QStringLiteral("FOO"), QStringLiteral("1")}});
+    ClangParsingEnvironment sameDefines = environment;
+    sameDefines.addIncludes({Path(QStringLiteral("/tmp"))});
+    ClangParsingEnvironment otherDefines;
+    otherDefines.addDefines({{QStringLiteral("FOO"), QStringLiteral("2")}});
+
+    auto file = index.definesFile(environment);
+    QVERIFY(file);
+    QVERIFY(QFile::exists(file->fileName()));
+    QCOMPARE(index.definesFile(sameDefines), file);
+    QVERIFY(index.definesFile(otherDefines) != file);
+
+    {
+        QFile contents(file->fileName());
+        QVERIFY(contents.open(QIODevice::ReadOnly));
+        QCOMPARE(contents.readAll(), QByteArray("#define FOO 1\n"));
+    }
+
+    const auto fileName = file->fileName();
+    file.clear();
+    QVERIFY(!QFile::exists(fileName));
+    file = index.definesFile(environment);
+    QVERIFY(QFile::exists(file->fileName()));
+}
+
+void TestDUChain::testSharedPchInclude()
+{
+    QTemporaryDir pchDir;
+    ClangIndex index;
+    index.setPchDirectory(pchDir.path());
+    const Path a(QStringLiteral("/tmp/a.h"));
+    const Path b(QStringLiteral("/tmp/b.h"));
+    const Path c(QStringLiteral("/tmp/c.h"));
+
+    auto environmentFor = [] (const QString& tuUrl) {
+        ClangParsingEnvironment environment;
+        environment.setTranslationUnitUrl(IndexedString(tuUrl));
+        return environment;
+    };
+    const auto tu1 = environmentFor(QStringLiteral("/tmp/1.cpp"));
+    const auto tu2 = environmentFor(QStringLiteral("/tmp/2.cpp"));
+    const auto tu3 = environmentFor(QStringLiteral("/tmp/3.cpp"));
+
+    index.setIncludePrefix(tu1, {a, b, c});
+    index.setIncludePrefix(tu2, {a, b});
+    QVERIFY(!index.sharedPchInclude(tu1).isValid());
+
+    index.setIncludePrefix(tu3, {a, b, a});
+    const auto header = index.sharedPchInclude(tu1);
+    QVERIFY(header.isValid());
+    QCOMPARE(index.sharedPchInclude(tu2), header);
+    QCOMPARE(index.sharedPchInclude(tu3), header);
+
+    QFile file(header.toLocalFile());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), QByteArray("#include \"/tmp/a.h\"\n#include \"/tmp/b.h\"\n"));
+    file.close();
+
+    // a different environment does not share the prefix
+    auto otherTu = environmentFor(QStringLiteral("/tmp/4.cpp"));
+    otherTu.addDefines({{QStringLiteral("FOO"), QStringLiteral("1")}});
+    index.setIncludePrefix(otherTu, {a, b});
+    QVERIFY(!index.sharedPchInclude(otherTu).isValid());
+
+    // once no TU uses the prefix anymore, its PCH is removed, but the header is kept for the DUChain
+    const QString pchFile = header.toLocalFile() + QStringLiteral(".pch");
+    QFile(pchFile).open(QIODevice::WriteOnly);
+    for (const auto& tu : {tu1, tu2, tu3}) {
+        index.setIncludePrefix(tu, {c});
+        QVERIFY(QFile::exists(pchFile));
+        index.sharedPchInclude(tu);
+    }
+    QVERIFY(!QFile::exists(pchFile));
+    QVERIFY(QFile::exists(header.toLocalFile()));
+
+    // without a PCH directory, no prefix headers are created
+    ClangIndex noPchIndex;
+    for (const auto& tu : {tu1, tu2, tu3}) {
+        noPchIndex.setIncludePrefix(tu, {a, b});
+    }
+    QVERIFY(!noPchIndex.sharedPchInclude(tu1).isValid());
+}
+
+void TestDUChain::testSharedPchParse()
+{
+    QTemporaryDir pchDir;
+    ClangIndex index;
+    index.setPchDirectory(pchDir.path());
+
+    TestFile header("#pragma once\nstruct Shared { int member; };\n", "h");
+    TestFile defined("#pragma once\n#ifdef FOO\nstruct Defined {};\n#endif\n", "h");
+    const QString includes = QStringLiteral("#include \"%1\"\n#include \"%2\"\n").arg(header.url().str(), defined.url().str());
+    TestFile tu1(includes + QStringLiteral("int a() { return Shared().member; }\n"), "cpp");
+    TestFile tu2(includes + QStringLiteral("int b() { return Shared().member; }\n"), "cpp");
+    TestFile tu3(includes + QStringLiteral("Defined c() { return {}; }\n"), "cpp");
+
+    auto environmentFor = [] (const TestFile& tu) {
+        ClangParsingEnvironment environment;
+        environment.setTranslationUnitUrl(tu.url());
+        environment.addDefines({{QStringLiteral("FOO"), QStringLiteral("1")}});
+        return environment;
+    };
+    for (const auto* tu : {&tu1, &tu2, &tu3}) {
+        index.setIncludePrefix(environmentFor(*tu), {Path(header.url().str()), Path(defined.url().str())});
+    }
+
+    auto environment = environmentFor(tu3);
+    const auto pchInclude = index.sharedPchInclude(environment);
+    QVERIFY(pchInclude.isValid());
+    QVERIFY(Path(pchDir.path()).isParentOf(pchInclude));
+    environment.setPchInclude(pchInclude);
+
+    // the prefix gets precompiled with the defines of the translation units
+    const auto pch = index.pch(environment);
+    QVERIFY(pch);
+    QVERIFY(QFile::exists(pchInclude.toLocalFile() + QStringLiteral(".pch")));
+    {
+        DUChainReadLocker lock;
+        QVERIFY(pch->context());
+        QVERIFY(!pch->context()->findDeclarations(QualifiedIdentifier(QStringLiteral("Defined"))).isEmpty());
+    }
+    QVERIFY(index.pch(environment) == pch);
+
+    // and the translation unit gets parsed through it
+    ParseSession session(ParseSessionData::Ptr(new ParseSessionData({}, &index, environment)));
+    QVERIFY(session.unit());
+    QCOMPARE(clang_getNumDiagnostics(session.unit()), 0u);
+
+    // a user defined PCH include is shared by all environments
+    TestFile userPch("#pragma once\nstruct User {};\n", "h");
+    auto userEnvironment = environmentFor(tu1);
+    userEnvironment.setPchInclude(Path(userPch.url().str()));
+    auto otherUserEnvironment = environmentFor(tu2);
+    otherUserEnvironment.addDefines({{QStringLiteral("FOO"), QStringLiteral("2")}});
+    otherUserEnvironment.setPchInclude(Path(userPch.url().str()));
+    const auto userPchData = index.pch(userEnvironment);
+    QVERIFY(userPchData);
+    QVERIFY(index.pch(otherUserEnvironment) == userPchData);
+}
+
+void TestDUChain::testTranslationUnitMemoryBudget()
+{
+    ClangIndex index;
+    TestFile file1("struct A { int member; };\n", "cpp");
+    TestFile file2("struct B { int member; };\n", "cpp");
+
+    auto createSession = [&index] (const TestFile& file) {
+        ClangParsingEnvironment environment;
+        environment.setTranslationUnitUrl(file.url());
+        return ParseSessionData::Ptr(new ParseSessionData({}, &index, environment));
+    };
+    auto data1 = createSession(file1);
+    auto data2 = createSession(file2);
+
+    const auto usage = index.translationUnitMemoryUsage();
+    QVERIFY(usage > 0);
+
+    {
+        // sessions in use are never evicted
+        ParseSession session(data2);
+        index.setTranslationUnitMemoryBudget(1);
+        QVERIFY(session.unit());
+        QVERIFY(index.translationUnitMemoryUsage() < usage);
+    }
+
+    index.setTranslationUnitMemoryBudget(0);
+    index.setTranslationUnitMemoryBudget(1);
+    QCOMPARE(index.translationUnitMemoryUsage(), quint64(0));
+
+    // evicted translation units are only parsed again on demand, with the given unsaved contents
+    index.setTranslationUnitMemoryBudget(0);
+    ParseSession session(data1);
+    QVERIFY(!session.unit());
+    QVERIFY(!session.isCompletable());
+    session.ensureCompletable({UnsavedFile(file1.url().str(), QByteArray("struct A { int other; };\n"))});
+    QVERIFY(session.isCompletable());
+    QVERIFY(session.unit());
+    QVERIFY(session.mainFile());
+    QVERIFY(session.hasUnsavedContents(file1.url()));
+    QVERIFY(index.translationUnitMemoryUsage() > 0);
+}
+
+void TestDUChain::testTranslationUnitForUrl()
+{
+    QTemporaryDir dir;
+    auto createFile = [&dir] (const QString& name) {
+        QFile file(dir.path() + QLatin1Char('/') + name);
+        file.open(QIODevice::WriteOnly);
+        return IndexedString(file.fileName());
+    };
+
+    ClangIndex index;
+    // results outside of projects are not cached
+    const auto bar = createFile(QStringLiteral("bar.h"));
+    QCOMPARE(index.translationUnitForUrl(bar), bar);
+    const auto barSource = createFile(QStringLiteral("bar.cpp"));
+    QCOMPARE(index.translationUnitForUrl(bar), barSource);
+
+    index.setProjectPaths({Path(dir.path())});
+    const auto header = createFile(QStringLiteral("foo.h"));
+    QCOMPARE(index.translationUnitForUrl(header), header);
+    // let the watcher pick up the directory
+    QCoreApplication::processEvents();
+
+    const auto source = createFile(QStringLiteral("foo.cpp"));
+    QTRY_COMPARE(index.translationUnitForUrl(header), source);
+
+    const auto other = createFile(QStringLiteral("other.cpp"));
+    index.pinTranslationUnitForUrl(other, header);
+    QCOMPARE(index.translationUnitForUrl(header), other);
+    index.unpinTranslationUnitForUrl(header);
+    QCOMPARE(index.translationUnitForUrl(header), source);
+}
+
+void TestDUChain::testAbortBuildDUChain()
+{
+    TestFile header("#pragma once\nstruct Header { int member; };\n", "h");
+    TestFile impl("#include \"" + header.url().byteArray() + "\"\n"
+                  "int main() { return Header().member; }\n", "cpp");
+
+    ClangIndex index;
+    ClangParsingEnvironment environment;
+    environment.setTranslationUnitUrl(impl.url());
+    ParseSession session(ParseSessionData::Ptr(new ParseSessionData({}, &index, environment)));
+    QVERIFY(session.unit());
+    const auto imports = ClangHelpers::tuImports(session.unit());
+    const auto features = static_cast<TopDUContext::Features>(TopDUContext::AllDeclarationsContextsAndUses | TopDUContext::ForceUpdate);
+
+    for (int threads : {1, 4}) {
+        // the header gets built, then the build is aborted before the main file
+        int calls = 0;
+        IncludeFileContexts includedFiles;
+        auto top = ClangHelpers::buildDUChain(session.mainFile(), imports, session, features,
+                                              includedFiles, &index, threads, [&calls] { return ++calls > 1; });
+        QVERIFY(!top);
+        {
+            DUChainReadLocker lock;
+            auto headerCtx = DUChain::self()->chainForDocument(header.url());
+            QVERIFY(headerCtx);
+            QCOMPARE(headerCtx->localDeclarations().size(), 1);
+        }
+
+        includedFiles.clear();
+        top = ClangHelpers::buildDUChain(session.mainFile(), imports, session, features,
+                                         includedFiles, &index, threads);
+        QVERIFY(top);
+        DUChainReadLocker lock;
+        QCOMPARE(top->localDeclarations().size(), 1);
+        QCOMPARE(top->importedParentContexts().size(), 1);
+    }
+}
@@ -25,6 +25,10 @@
 
 class TestEnvironmentProvider;
 
+namespace KDevelop {
+class TestProjectController;
+}
+
 class TestDUChain : public QObject
 {
     Q_OBJECT
@@ -71,11 +75,23 @@ private slots:
     void testNestedMacroRanges();
     void testGotoStatement();
     void testRangesOfOperatorsInsideMacro();
+    void testParallelBuilder();
+    void testTouchedHeaderNotRebuilt();
+    void testSharedDefinesFile();
+    void testSharedPchInclude();
+    void testSharedPchParse();
+    void testTranslationUnitMemoryBudget();
+    void testTranslationUnitForUrl();
+    void testAbortBuildDUChain();
+    void testIndexerResultReused();
+    void testEnvironmentCacheInvalidation();
+    void testTwoTierIndexing();
 
     void benchDUChainBuilder();
 
 private:
     QScopedPointer<TestEnvironmentProvider> m_provider;
+    KDevelop::TestProjectController* m_projectController = nullptr;
 };
 
 #endif // DUCHAINTEST_H
@@ -0,0 +1,237 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clangprofiler.h"
+
+#include "clangdebug.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
+namespace {
+
+struct Event
+{
+    const char* phase;
+    QString document;
+    QString project;
+    qint64 startTime;
+    qint64 wallTime;
+    qint64 cpuTime;
+    quintptr thread;
+};
+
+/// @return the CPU time of the calling thread in microseconds, or 0 if unsupported
+qint64 threadCpuTime()
+{
+#if defined(Q_OS_UNIX) && defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0) {
+        return static_cast<qint64>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+    }
+#endif
+    return 0;
+}
+
+QString profileDirectory()
+{
+    const auto value = QString::fromLocal8Bit(qgetenv("KDEV_CLANG_PROFILE"));
+    if (value.isEmpty() || value == QLatin1String("0")) {
+        return {};
+    }
+    return value == QLatin1String("1") ? QDir::tempPath() : value;
+}
+
+QJsonObject percentiles(QVector<qint64> wallTimes, QVector<qint64> cpuTimes)
+{
+    std::sort(wallTimes.begin(), wallTimes.end());
+    std::sort(cpuTimes.begin(), cpuTimes.end());
+    // nearest-rank percentile
+    auto percentile = [] (const QVector<qint64>& sorted, int p) {
+        const int rank = std::max(1, (p * sorted.size() + 99) / 100);
+        return static_cast<double>(sorted.at(rank - 1));
+    };
+    return {
+        {QStringLiteral("count"), wallTimes.size()},
+        {QStringLiteral("wallP50"), percentile(wallTimes, 50)},
+        {QStringLiteral("wallP95"), percentile(wallTimes, 95)},
+        {QStringLiteral("cpuP50"), percentile(cpuTimes, 50)},
+        {QStringLiteral("cpuP95"), percentile(cpuTimes, 95)}
+    };
+}
+
+class Profile
+{
+public:
+    Profile()
+        : directory(profileDirectory())
+    {
+        clock.start();
+    }
+
+    /// Write the trace and the summary of all events recorded so far, requires the mutex
+    void dump()
+    {
+        const auto pid = QCoreApplication::applicationPid();
+
+        QJsonArray traceEvents;
+        QHash<QString, QPair<QVector<qint64>, QVector<qint64>>> phases;
+        QHash<QString, QHash<QString, QPair<QVector<qint64>, QVector<qint64>>>> projects;
+        for (const auto& event : events) {
+            const auto phase = QString::fromLatin1(event.phase);
+            traceEvents.append(QJsonObject{
+                {QStringLiteral("name"), phase},
+                {QStringLiteral("cat"), QStringLiteral("parse")},
+                {QStringLiteral("ph"), QStringLiteral("X")},
+                {QStringLiteral("ts"), static_cast<double>(event.startTime)},
+                {QStringLiteral("dur"), static_cast<double>(event.wallTime)},
+                {QStringLiteral("pid"), static_cast<double>(pid)},
+                {QStringLiteral("tid"), static_cast<double>(event.thread)},
+                {QStringLiteral("args"), QJsonObject{
+                    {QStringLiteral("document"), event.document},
+                    {QStringLiteral("project"), event.project},
+                    {QStringLiteral("cpu"), static_cast<double>(event.cpuTime)}
+                }}
+            });
+
+            auto& times = phases[phase];
+            times.first.append(event.wallTime);
+            times.second.append(event.cpuTime);
+            if (!event.project.isEmpty()) {
+                auto& projectTimes = projects[event.project][phase];
+                projectTimes.first.append(event.wallTime);
+                projectTimes.second.append(event.cpuTime);
+            }
+        }
+
+        QJsonObject phaseSummary;
+        for (auto it = phases.constBegin(); it != phases.constEnd(); ++it) {
+            phaseSummary.insert(it.key(), percentiles(it->first, it->second));
+        }
+        QJsonObject projectSummary;
+        for (auto it = projects.constBegin(); it != projects.constEnd(); ++it) {
+            QJsonObject summary;
+            for (auto phase = it->constBegin(); phase != it->constEnd(); ++phase) {
+                summary.insert(phase.key(), percentiles(phase->first, phase->second));
+            }
+            projectSummary.insert(it.key(), summary);
+        }
+
+        write(QStringLiteral("kdev-clang-trace-%1.json").arg(pid),
+              QJsonObject{{QStringLiteral("traceEvents"), traceEvents},
+                          {QStringLiteral("displayTimeUnit"), QStringLiteral("ms")}});
+        write(QStringLiteral("kdev-clang-profile-%1.json").arg(pid),
+              QJsonObject{{QStringLiteral("unit"), QStringLiteral("us")},
+                          {QStringLiteral("phases"), phaseSummary},
+                          {QStringLiteral("projects"), projectSummary}});
+    }
+
+    void write(const QString& fileName, const QJsonObject& object)
+    {
+        QFile file(QDir(directory).filePath(fileName));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCWarning(KDEV_CLANG) << "failed to write profile" << file.fileName();
+            return;
+        }
+        file.write(QJsonDocument(object).toJson(QJsonDocument::Compact));
+        clangDebug() << "wrote profile" << file.fileName();
+    }
+
+    const QString directory;
+    QElapsedTimer clock;
+    QMutex mutex;
+    QVector<Event> events;
+};
+
+Q_GLOBAL_STATIC(Profile, s_profile)
+
+}
+
+bool ClangProfiler::isEnabled()
+{
+    static const bool enabled = !profileDirectory().isEmpty();
+    return enabled;
+}
+
+void ClangProfiler::record(const char* phase, const QString& document, const QString& project,
+                           qint64 startTime, qint64 wallTime, qint64 cpuTime)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    const auto thread = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    QMutexLocker lock(&s_profile->mutex);
+    s_profile->events.append({phase, document, project, startTime, wallTime, cpuTime, thread});
+}
+
+void ClangProfiler::flush()
+{
+    if (!isEnabled() || s_profile.isDestroyed()) {
+        return;
+    }
+    QMutexLocker lock(&s_profile->mutex);
+    if (!s_profile->events.isEmpty()) {
+        s_profile->dump();
+    }
+}
+
+ClangProfiler::Scope::Scope(const char* phase, const QString& document, const QString& project)
+    : m_phase(phase)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    m_document = document;
+    m_project = project;
+    m_startCpuTime = threadCpuTime();
+    m_startTime = s_profile->clock.nsecsElapsed() / 1000;
+}
+
+void ClangProfiler::Scope::setProject(const QString& project)
+{
+    if (m_startTime != -1) {
+        m_project = project;
+    }
+}
+
+ClangProfiler::Scope::~Scope()
+{
+    if (m_startTime == -1) {
+        return;
+    }
+    const auto wallTime = s_profile->clock.nsecsElapsed() / 1000 - m_startTime;
+    record(m_phase, m_document, m_project, m_startTime, wallTime, threadCpuTime() - m_startCpuTime);
+}
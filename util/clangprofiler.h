@@ -0,0 +1,84 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CLANGPROFILER_H
+#define CLANGPROFILER_H
+
+#include <QString>
+
+/**
+ * Records the wall and CPU time spent in the phases of parse jobs.
+ *
+ * Profiling is enabled by pointing the KDEV_CLANG_PROFILE environment variable to a directory,
+ * or setting it to 1 to use the temporary directory. On flush(), two files are written there:
+ * a Chrome trace with one event per recorded phase (kdev-clang-trace-<pid>.json), loadable in
+ * chrome://tracing, and the p50/p95 timings per phase and per project (kdev-clang-profile-<pid>.json).
+ */
+namespace ClangProfiler
+{
+    /**
+     * @return true when the KDEV_CLANG_PROFILE environment variable is set
+     */
+    bool isEnabled();
+
+    /**
+     * Record that @p phase of the parse job for @p document in @p project took
+     * @p wallTime microseconds, starting at @p startTime, and @p cpuTime microseconds of CPU time.
+     *
+     * This function is thread safe.
+     */
+    void record(const char* phase, const QString& document, const QString& project,
+                qint64 startTime, qint64 wallTime, qint64 cpuTime);
+
+    /**
+     * Write the profile of all phases recorded so far, replacing the files of an earlier flush.
+     *
+     * Called when the language support gets destroyed, nothing is written on static destruction.
+     * This function is thread safe.
+     */
+    void flush();
+
+    /**
+     * Record the time spent in a phase, from construction until destruction.
+     *
+     * Does nothing when profiling is disabled.
+     */
+    class Scope
+    {
+    public:
+        Scope(const char* phase, const QString& document, const QString& project = {});
+        ~Scope();
+
+        /// Set the project of the recorded document, when it is not known on construction
+        void setProject(const QString& project);
+
+    private:
+        Q_DISABLE_COPY(Scope)
+
+        const char* m_phase;
+        QString m_document;
+        QString m_project;
+        qint64 m_startTime = -1;
+        qint64 m_startCpuTime = 0;
+    };
+}
+
+#endif // CLANGPROFILER_H